@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <vector>
+#include <zlib.h>
+#include "Archive.hpp"
+
+Archive::Archive(std::shared_ptr<FileSystem> fileSystem) {
+    this->fileSystem = std::move(fileSystem);
+}
+
+int Archive::save(const std::string& hostFile, bool compress) {
+    // "T" writes the same stream without compression
+    gzFile file = gzopen(hostFile.c_str(), compress ? "wb6" : "wbT");
+    if (file == nullptr) {
+        return 1;
+    }
+
+    this->fileSystem->syncChecksums();
+    archive_header header{ARCHIVE_MAGIC, ARCHIVE_VERSION, this->fileSystem->imageSize()};
+    gzwrite(file, &header, sizeof(archive_header));
+
+    std::vector<char> buffer(1 << 20);
+    for (const auto &extent : this->fileSystem->usedExtents()) {
+        archive_extent item{extent.first, extent.second};
+        gzwrite(file, &item, sizeof(archive_extent));
+        for (int64_t done = 0; done < extent.second; ) {
+            int64_t chunk = std::min<int64_t>(buffer.size(), extent.second - done);
+            this->fileSystem->read(buffer.data(), chunk, extent.first + done);
+            gzwrite(file, buffer.data(), (unsigned) chunk);
+            done += chunk;
+        }
+    }
+    archive_extent end{0, 0};
+    gzwrite(file, &end, sizeof(archive_extent));
+
+    return gzclose(file) == Z_OK ? 0 : 1;
+}
+
+void Archive::adoptVolume(superblock* block) const {
+    // the archive holds the logical image - it takes the layout of the volume it is restored onto
+    if (block->magic == SUPERBLOCK_MAGIC && block->group_table_address >= SUPERBLOCK_SIZE) {
+        block->stripe_unit = this->fileSystem->stripeUnit();
+        block->stripe_count = this->fileSystem->stripeCount();
+    }
+}
+
+int Archive::restore(const std::string& hostFile) {
+    // reads compressed and uncompressed archives alike
+    gzFile file = gzopen(hostFile.c_str(), "rb");
+    if (file == nullptr) {
+        return 1;
+    }
+    archive_header header{};
+    if (gzread(file, &header, sizeof(archive_header)) != sizeof(archive_header)
+        || header.magic != ARCHIVE_MAGIC || header.version != ARCHIVE_VERSION || header.image_size <= 0) {
+        gzclose(file);
+        return 2;
+    }
+
+    this->fileSystem->create(header.image_size);
+    std::vector<char> buffer(1 << 20);
+    archive_extent item{};
+    int status = 3;
+    while (gzread(file, &item, sizeof(archive_extent)) == sizeof(archive_extent)) {
+        if (item.length == 0) {
+            status = 0;
+            break;
+        }
+        if (item.address < 0 || item.length < 0 || item.address + item.length > header.image_size) {
+            break;
+        }
+        int64_t done = 0;
+        while (done < item.length) {
+            int64_t chunk = std::min<int64_t>(buffer.size(), item.length - done);
+            if (gzread(file, buffer.data(), (unsigned) chunk) != chunk) {
+                break;
+            }
+            if (item.address + done == 0 && chunk >= SUPERBLOCK_SIZE) {
+                this->adoptVolume(reinterpret_cast<superblock *>(buffer.data()));
+            }
+            this->fileSystem->write(buffer.data(), chunk, item.address + done);
+            done += chunk;
+        }
+        if (done < item.length) {
+            break;
+        }
+    }
+    gzclose(file);
+    return status;
+}
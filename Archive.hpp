@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "FileSystem.hpp"
+
+class Archive {
+public:
+    explicit Archive(std::shared_ptr<FileSystem> fileSystem);
+
+    int save(const std::string& hostFile, bool compress);
+    int restore(const std::string& hostFile);
+
+protected:
+    std::shared_ptr<FileSystem> fileSystem;
+
+    void adoptVolume(superblock* block) const;
+};
@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <cstring>
+#include "Checker.hpp"
+
+Checker::Checker(std::shared_ptr<FileSystem> fileSystem) {
+    this->fileSystem = std::move(fileSystem);
+}
+
+int Checker::check(bool repair) {
+    int32_t inodeCount = this->fileSystem->inodeCount();
+    int64_t clusterCount = this->fileSystem->clusterIndexCount();
+    this->references.reset(new std::atomic<int32_t>[inodeCount]);
+    this->claimed.reset(new std::atomic<bool>[clusterCount]);
+    for (int32_t i = 0; i < inodeCount; ++i) {
+        this->references[i] = 0;
+    }
+    for (int64_t i = 0; i < clusterCount; ++i) {
+        this->claimed[i] = false;
+    }
+
+    // 1. live inodes from the inode table
+    this->scanInodes();
+    if (this->inodes.empty() || this->inodes.front().node_id != 0 || !this->inodes.front().isDirectory) {
+        this->report("ROOT DIRECTORY MISSING");
+    }
+
+    // 2. link counts from all directory entries
+    for (const pseudo_inode &inode : this->inodes) {
+        if (inode.isDirectory) {
+            this->pool.submit([this, &inode] { this->countReferences(inode); });
+        }
+    }
+    this->pool.wait();
+
+    // 3. clusters reachable from block maps of referenced inodes
+    std::vector<bool> usedInodes(inodeCount, false);
+    for (pseudo_inode &inode : this->inodes) {
+        int32_t expected = this->references[inode.node_id];
+        bool orphan = expected == 0 && inode.node_id != 0;
+        if (orphan) {
+            this->report("INODE " + std::to_string(inode.node_id) + " - NOT REFERENCED");
+        } else if (expected != inode.references) {
+            this->report("INODE " + std::to_string(inode.node_id) + " - REFERENCES " + std::to_string(inode.references) + " EXPECTED " + std::to_string(expected));
+            if (repair) {
+                inode.references = (int8_t) expected;
+                this->fileSystem->saveInode(&inode);
+            }
+        }
+        if (orphan && repair) {
+            continue;
+        }
+        usedInodes[inode.node_id] = true;
+        this->pool.submit([this, &inode] { this->claimClusters(inode); });
+    }
+    this->pool.wait();
+    // a group table moved by grow owns its clusters
+    for (int64_t address : this->fileSystem->groupTableClusters()) {
+        this->claim(-1, address);
+    }
+
+    // 4. compare with the cluster bitmap
+    std::vector<bool> usedClusters(clusterCount, false);
+    int64_t claimedCount = 0;
+    for (int64_t i = 0; i < clusterCount; ++i) {
+        usedClusters[i] = this->claimed[i];
+        claimedCount += usedClusters[i] ? 1 : 0;
+        if (usedClusters[i] && !this->fileSystem->isClusterUsed(i)) {
+            this->report("CLUSTER " + std::to_string(i) + " - USED BUT FREE IN BITMAP");
+        } else if (!usedClusters[i] && this->fileSystem->isClusterUsed(i)) {
+            this->report("CLUSTER " + std::to_string(i) + " - LEAKED");
+        }
+    }
+
+    std::sort(this->errors.begin(), this->errors.end());
+    const size_t maxPrinted = 100;
+    for (size_t i = 0; i < this->errors.size() && i < maxPrinted; ++i) {
+        std::cout << this->errors[i] << std::endl;
+    }
+    if (this->errors.size() > maxPrinted) {
+        std::cout << "... " << (this->errors.size() - maxPrinted) << " MORE" << std::endl;
+    }
+    std::cout << "INODES " << this->inodes.size() << " - CLUSTERS " << claimedCount << " - ERRORS " << this->errors.size() << std::endl;
+
+    if (repair && !this->errors.empty()) {
+        this->fileSystem->rebuildBitmaps(usedInodes, usedClusters);
+        std::cout << "REPAIRED" << std::endl;
+        return 0;
+    }
+    return this->errors.empty() ? 0 : 1;
+}
+
+void Checker::scanInodes() {
+    // the inode table is read in large chunks in parallel, chunks never cross a group
+    int32_t inodeCount = this->fileSystem->inodeCount();
+    int32_t perGroup = this->fileSystem->inodesPerGroup();
+    const int32_t chunk = 4096;
+    std::vector<std::pair<int32_t, int32_t>> ranges;
+    for (int32_t first = 0; first < inodeCount;) {
+        int32_t groupEnd = (first / perGroup + 1) * perGroup;
+        int32_t end = std::min(std::min(first + chunk, groupEnd), inodeCount);
+        ranges.emplace_back(first, end);
+        first = end;
+    }
+
+    std::vector<std::vector<pseudo_inode>> found(ranges.size());
+    for (size_t index = 0; index < ranges.size(); ++index) {
+        int32_t first = ranges[index].first;
+        int32_t end = ranges[index].second;
+        std::vector<pseudo_inode> &target = found[index];
+        this->pool.submit([this, first, end, &target] {
+            std::vector<pseudo_inode> table = this->fileSystem->readInodes(first, end - first);
+            for (int32_t i = first; i < end; ++i) {
+                if (this->fileSystem->isInodeUsed(i)) {
+                    pseudo_inode &inode = table[i - first];
+                    if (inode.node_id != i) {
+                        this->report("INODE " + std::to_string(i) + " - WRONG ID " + std::to_string(inode.node_id));
+                        inode.node_id = i;
+                    }
+                    target.push_back(inode);
+                }
+            }
+        });
+    }
+    this->pool.wait();
+
+    for (const std::vector<pseudo_inode> &part : found) {
+        this->inodes.insert(this->inodes.end(), part.begin(), part.end());
+    }
+}
+
+void Checker::countReferences(const pseudo_inode& inode) {
+    std::vector<char> content;
+    if (inode.flags & INODE_FLAG_INLINE) {
+        auto size = (size_t) std::min<int64_t>(inode.file_size, this->fileSystem->inlineDataSize());
+        content.assign(reinterpret_cast<const char *>(inode.direct), reinterpret_cast<const char *>(inode.direct) + size);
+    } else if (inode.file_size > 0 && inode.file_size <= this->fileSystem->maxFileSize()) {
+        std::vector<int64_t> data;
+        std::vector<int64_t> links;
+        makePooled<INode>(makePooled<pseudo_inode>(inode))->blockMap(this->fileSystem, data, links);
+        int64_t clusterSize = this->fileSystem->clusterSize();
+        content.resize(data.size() * clusterSize);
+        for (size_t i = 0; i < data.size(); ++i) {
+            if (this->fileSystem->clusterIndex(data[i]) != -1) {
+                this->fileSystem->read(content.data() + i * clusterSize, clusterSize, data[i]);
+            }
+        }
+        content.resize(inode.file_size);
+    }
+
+    for (size_t offset = 0; offset + sizeof(directory_item) <= content.size(); offset += sizeof(directory_item)) {
+        directory_item item{};
+        memcpy(&item, content.data() + offset, sizeof(directory_item));
+        if (!this->fileSystem->isInodeUsed(item.inode)) {
+            this->report("INODE " + std::to_string(inode.node_id) + " - ENTRY " + std::string(item.item_name, strnlen(item.item_name, 12)) + " POINTS TO FREE INODE " + std::to_string(item.inode));
+            continue;
+        }
+        this->references[item.inode]++;
+    }
+}
+
+void Checker::claimClusters(const pseudo_inode& inode) {
+    if (inode.flags & INODE_FLAG_INLINE) {
+        return;
+    }
+    if (inode.file_size < 0 || inode.file_size > this->fileSystem->maxFileSize()) {
+        this->report("INODE " + std::to_string(inode.node_id) + " - INVALID SIZE " + std::to_string(inode.file_size));
+        return;
+    }
+    std::vector<int64_t> data;
+    std::vector<int64_t> links;
+    makePooled<INode>(makePooled<pseudo_inode>(inode))->blockMap(this->fileSystem, data, links);
+    for (int64_t address : links) {
+        this->claim(inode.node_id, address);
+    }
+    for (int64_t address : data) {
+        this->claim(inode.node_id, address);
+    }
+}
+
+void Checker::claim(int32_t nodeId, int64_t address) {
+    int64_t index = this->fileSystem->clusterIndex(address);
+    if (index == -1) {
+        this->report("INODE " + std::to_string(nodeId) + " - INVALID LINK " + std::to_string(address));
+        return;
+    }
+    if (this->claimed[index].exchange(true)) {
+        this->report("CLUSTER " + std::to_string(index) + " - CLAIMED TWICE (INODE " + std::to_string(nodeId) + ")");
+    }
+}
+
+void Checker::report(const std::string& error) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->errors.push_back(error);
+}
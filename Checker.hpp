@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "FileSystem.hpp"
+#include "ThreadPool.hpp"
+
+class Checker {
+public:
+    explicit Checker(std::shared_ptr<FileSystem> fileSystem);
+
+    int check(bool repair);
+
+protected:
+    std::shared_ptr<FileSystem> fileSystem;
+    ThreadPool pool;
+    std::mutex mutex;
+    std::vector<std::string> errors;
+    std::vector<pseudo_inode> inodes;
+    std::unique_ptr<std::atomic<int32_t>[]> references;
+    std::unique_ptr<std::atomic<bool>[]> claimed;
+
+    void scanInodes();
+    void countReferences(const pseudo_inode& inode);
+    void claimClusters(const pseudo_inode& inode);
+    void claim(int32_t nodeId, int64_t address);
+    void report(const std::string& error);
+};
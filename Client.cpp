@@ -0,0 +1,40 @@
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include "Client.hpp"
+#include "Server.hpp"
+
+Client::Client(std::string socketPath) {
+    this->socketPath = std::move(socketPath);
+}
+
+int Client::run() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, this->socketPath.c_str(), sizeof(address.sun_path) - 1);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (sockaddr *) &address, sizeof(address)) != 0) {
+        std::cerr << "CANNOT CONNECT" << std::endl;
+        return 1;
+    }
+
+    // same prompt as the console, the daemon answers with the output and the new working directory
+    std::string line;
+    std::string output;
+    std::string pwd;
+    std::cout << "/$ ";
+    while (std::getline(std::cin, line)) {
+        if (!Server::sendFrame(server, line) || !Server::receiveFrame(server, output) || !Server::receiveFrame(server, pwd)) {
+            std::cerr << "CONNECTION LOST" << std::endl;
+            close(server);
+            return 2;
+        }
+        std::cout << output << pwd << "$ ";
+        std::cout.flush();
+    }
+    close(server);
+    return 0;
+}
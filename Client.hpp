@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+
+class Client {
+public:
+    explicit Client(std::string socketPath);
+
+    int run();
+
+protected:
+    std::string socketPath;
+};
@@ -23,36 +23,133 @@ void Console::readLine(const std::string& line) {
     std::string firstArg = firstSpace != std::string::npos ? line.substr(firstSpace + 1, secondSpace - (firstSpace + 1)) : "";
     std::string secondArg = secondSpace != std::string::npos ? line.substr(secondSpace + 1) : "";
 
-    if (command == "cp") {
+    if (this->trace.recording() && command != "record") {
+        this->trace.record(line);
+    }
+
+    if (command == "cp" && firstArg == "-r") {
+        auto args = split(secondArg, 2);
+        this->system->copyTree(args[0], args[1]);
+    } else if (command == "cp") {
         this->system->copyFile(firstArg, secondArg);
     } else if (command == "ln") {
         this->system->hardLink(firstArg, secondArg);
     } else if (command == "mv") {
         this->system->moveFile(firstArg, secondArg);
+    } else if (command == "rm" && firstArg == "-r") {
+        this->system->removeTree(secondArg);
     } else if (command == "rm") {
         this->system->removeFile(firstArg);
     } else if (command == "mkdir") {
         this->system->createDirectory(firstArg);
     } else if (command == "rmdir") {
         this->system->removeDirectory(firstArg);
+    } else if (command == "ls" && firstArg == "-l") {
+        this->system->listDirectory(secondArg, true);
     } else if (command == "ls") {
         this->system->listDirectory(firstArg);
+    } else if (command == "grep") {
+        auto args = arguments(line);
+        bool recursive = !args.empty() && args.back() == "-r";
+        args.resize(args.size() - (recursive ? 1 : 0));
+        this->system->grep(args.empty() ? "" : args[0], args.size() > 1 ? args[1] : "", recursive);
     } else if (command == "cat") {
-        this->system->printFile(firstArg);
+        this->system->printFiles(arguments(line));
     } else if (command == "cd") {
         this->system->cd(firstArg);
     } else if (command == "pws") {
         this->system->printPwd();
     } else if (command == "info") {
         this->system->info(firstArg);
+    } else if (command == "incp" && firstArg == "-r") {
+        auto args = split(secondArg, 2);
+        this->system->importTree(args[0], args[1]);
     } else if (command == "incp") {
         this->system->copyFromOutside(firstArg, secondArg);
+    } else if (command == "append") {
+        auto lastSpace = line.find_last_of(' ');
+        std::string source = lastSpace > firstSpace ? line.substr(firstSpace + 1, lastSpace - firstSpace - 1) : "";
+        this->system->appendFile(source, line.substr(lastSpace + 1));
     } else if (command == "outcp") {
-        this->system->copyToOutside(secondArg, firstArg);
+        // sources (globs allowed) and the host file or directory last
+        auto args = arguments(line);
+        std::string hostPath = args.empty() ? "" : args.back();
+        args.resize(args.empty() ? 0 : args.size() - 1);
+        this->system->copyToOutside(args, hostPath);
+    } else if (command == "prealloc") {
+        this->system->preallocate(firstArg, std::stoll(secondArg));
+    } else if (command == "export" && firstArg == "-z") {
+        this->system->exportImage(secondArg, true);
+    } else if (command == "export") {
+        this->system->exportImage(firstArg, false);
+    } else if (command == "import") {
+        this->system->importImage(firstArg);
+    } else if (command == "scrub") {
+        this->system->scrub(firstArg);
+    } else if (command == "discard") {
+        this->system->discard(firstArg);
+    } else if (command == "grow") {
+        this->system->grow(std::stoull(firstArg, nullptr, 0));
+    } else if (command == "trim") {
+        this->system->trim();
+    } else if (command == "df") {
+        this->system->diskFree();
+    } else if (command == "du") {
+        this->system->diskUsage(firstArg);
+    } else if (command == "frag") {
+        this->system->fragmentation(firstArg);
+    } else if (command == "defrag") {
+        this->system->defragment(firstArg, secondArg.empty() ? 0 : std::stoll(secondArg));
+    } else if (command == "fsck") {
+        this->system->check(firstArg == "-r");
+    } else if (command == "open") {
+        this->system->openFile(firstArg);
+    } else if (command == "close") {
+        this->system->closeFile(std::stoi(firstArg));
+    } else if (command == "flush") {
+        this->system->flushFile(std::stoi(firstArg));
+    } else if (command == "seek") {
+        this->system->seekFile(std::stoi(firstArg), std::stoll(secondArg));
+    } else if (command == "read") {
+        this->system->readFile(std::stoi(firstArg), -1, std::stoll(secondArg));
+    } else if (command == "write") {
+        this->system->writeFile(std::stoi(firstArg), -1, secondArg);
+    } else if (command == "pread") {
+        auto args = split(line, 4);
+        this->system->readFile(std::stoi(args[1]), std::stoll(args[2]), std::stoll(args[3]));
+    } else if (command == "pwrite") {
+        auto args = split(line, 4);
+        this->system->writeFile(std::stoi(args[1]), std::stoll(args[2]), args[3]);
+    } else if (command == "ftruncate") {
+        this->system->truncateFile(std::stoi(firstArg), std::stoll(secondArg));
     } else if (command == "load") {
         this->loadFile(firstArg);
+    } else if (command == "record" && firstArg == "stop") {
+        this->trace.stop();
+        std::cout << "OK" << std::endl;
+    } else if (command == "record") {
+        if (this->trace.start(firstArg) != 0) {
+            std::cerr << "CANNOT CREATE FILE" << std::endl;
+        } else {
+            std::cout << "OK" << std::endl;
+        }
+    } else if (command == "replay") {
+        Trace::replay(*this, firstArg, secondArg == "paced");
+    } else if (command == "gentrace") {
+        auto args = split(secondArg, 2);
+        Trace::generate(firstArg, args[0], !args[1].empty() ? std::stoll(args[1]) : 0);
     } else if (command == "format") {
-        this->system->format(std::stoul(firstArg, nullptr, 0));
+        int32_t clusterSize = CLUSTER_SIZE;
+        auto option = secondArg.find("--cluster-size");
+        if (option != std::string::npos) {
+            clusterSize = std::stoi(secondArg.substr(option + 14), nullptr, 0);
+        }
+        int32_t stripeUnit = STRIPE_UNIT;
+        option = secondArg.find("--stripe-unit");
+        if (option != std::string::npos) {
+            stripeUnit = std::stoi(secondArg.substr(option + 13), nullptr, 0);
+        }
+        this->system->format(std::stoull(firstArg, nullptr, 0), clusterSize, stripeUnit);
     }
 }
 
@@ -69,3 +166,35 @@ void Console::loadFile(const std::string& file) {
         this->readLine(line);
     }
 }
+
+std::vector<std::string> Console::arguments(const std::string& line) {
+    // every word after the command
+    std::vector<std::string> out;
+    size_t start = line.find(' ');
+    while (start != std::string::npos) {
+        size_t end = line.find(' ', start + 1);
+        std::string word = line.substr(start + 1, end == std::string::npos ? std::string::npos : end - start - 1);
+        if (!word.empty()) {
+            out.push_back(word);
+        }
+        start = end;
+    }
+    return out;
+}
+
+std::vector<std::string> Console::split(const std::string& line, size_t parts) {
+    // at most parts items, the last one takes the rest of the line
+    std::vector<std::string> out;
+    size_t start = 0;
+    while (out.size() + 1 < parts) {
+        auto space = line.find(' ', start);
+        if (space == std::string::npos) {
+            break;
+        }
+        out.push_back(line.substr(start, space - start));
+        start = space + 1;
+    }
+    out.push_back(start <= line.size() ? line.substr(start) : "");
+    out.resize(parts);
+    return out;
+}
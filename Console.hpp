@@ -1,6 +1,8 @@
 #pragma once
 #include <memory>
+#include <vector>
 #include "System.hpp"
+#include "Trace.hpp"
 
 class Console {
 public:
@@ -8,9 +10,12 @@ public:
     void run();
     void readLine(const std::string& line);
     void loadFile(const std::string& file);
+    static std::vector<std::string> split(const std::string& line, size_t parts);
+    static std::vector<std::string> arguments(const std::string& line);
 
 private:
     std::shared_ptr<System> system;
+    Trace trace;
 
 };
 
@@ -0,0 +1,104 @@
+#include <cstring>
+#include "Crc32c.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+// bytes per stream in one step of the interleaved kernel
+static const size_t STREAM_BLOCK = 256;
+
+uint32_t Crc32c::compute(const void* data, size_t size) {
+    // CRC32C (Castagnoli) - the polynomial of the SSE4.2 crc32 instruction
+    static const bool useHardware = hardware();
+    auto bytes = (const unsigned char *) data;
+    uint32_t crc = useHardware ? sse42(0xFFFFFFFFu, bytes, size) : software(0xFFFFFFFFu, bytes, size);
+    return ~crc;
+}
+
+bool Crc32c::hardware() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+uint32_t Crc32c::software(uint32_t crc, const unsigned char* data, size_t size) {
+    static uint32_t table[256];
+    static const bool ready = [] {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                value = (value >> 1) ^ ((value & 1) ? 0x82F63B78u : 0);
+            }
+            table[i] = value;
+        }
+        return true;
+    }();
+    (void) ready;
+
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+uint32_t Crc32c::shift(uint32_t crc) {
+    // the state after STREAM_BLOCK zero bytes - CRC is linear, so one table per state byte
+    static uint32_t tables[4][256];
+    static const bool ready = [] {
+        unsigned char zeros[STREAM_BLOCK] = {};
+        for (int k = 0; k < 4; ++k) {
+            for (uint32_t v = 0; v < 256; ++v) {
+                tables[k][v] = software(v << (8 * k), zeros, STREAM_BLOCK);
+            }
+        }
+        return true;
+    }();
+    (void) ready;
+
+    return tables[0][crc & 0xFF] ^ tables[1][(crc >> 8) & 0xFF] ^ tables[2][(crc >> 16) & 0xFF] ^ tables[3][crc >> 24];
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t Crc32c::sse42(uint32_t crc, const unsigned char* data, size_t size) {
+    // three independent streams hide the latency of the crc32 instruction
+    const size_t block = STREAM_BLOCK;
+    uint64_t value = crc;
+    while (size >= 3 * block) {
+        uint64_t a = value;
+        uint64_t b = 0;
+        uint64_t c = 0;
+        for (size_t i = 0; i < block; i += 8) {
+            uint64_t x, y, z;
+            memcpy(&x, data + i, 8);
+            memcpy(&y, data + block + i, 8);
+            memcpy(&z, data + 2 * block + i, 8);
+            a = _mm_crc32_u64(a, x);
+            b = _mm_crc32_u64(b, y);
+            c = _mm_crc32_u64(c, z);
+        }
+        value = shift(shift((uint32_t) a) ^ (uint32_t) b) ^ (uint32_t) c;
+        data += 3 * block;
+        size -= 3 * block;
+    }
+    while (size >= 8) {
+        uint64_t x;
+        memcpy(&x, data, 8);
+        value = _mm_crc32_u64(value, x);
+        data += 8;
+        size -= 8;
+    }
+    auto small = (uint32_t) value;
+    while (size > 0) {
+        small = _mm_crc32_u8(small, *data++);
+        size--;
+    }
+    return small;
+}
+#else
+uint32_t Crc32c::sse42(uint32_t crc, const unsigned char* data, size_t size) {
+    return software(crc, data, size);
+}
+#endif
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class Crc32c {
+public:
+    static uint32_t compute(const void* data, size_t size);
+    static bool hardware();
+
+private:
+    static uint32_t software(uint32_t crc, const unsigned char* data, size_t size);
+    static uint32_t sse42(uint32_t crc, const unsigned char* data, size_t size);
+    static uint32_t shift(uint32_t crc);
+};
@@ -5,20 +5,71 @@
 Directory::Directory(std::shared_ptr<INode> inode, std::shared_ptr<FileSystem> fileSystem) {
     this->inode = std::move(inode);
     this->fileSystem = std::move(fileSystem);
+}
+
+void Directory::load() const {
+    // all items in one read, only when the whole list is needed
+    if (this->loaded) {
+        return;
+    }
+    MemoryIterator input(*this->inode, *this->fileSystem, false);
+    this->items.resize((size_t) (input.size() / (int64_t) sizeof(directory_item)));
+    int64_t done = input.read(reinterpret_cast<char *>(this->items.data()), this->items.size() * sizeof(directory_item));
+    this->items.resize((size_t) done / sizeof(directory_item));
+    this->loaded = true;
+}
 
+Directory::Iterator::Iterator(const std::shared_ptr<INode>& directory, const std::shared_ptr<FileSystem>& fileSystem)
+    : input(directory, fileSystem, false), buffer(fileSystem->clusterSize() / sizeof(directory_item)) {
+}
 
-    auto input = this->inode->getInputStream(this->fileSystem);
-    directory_item item{};
-    while (input.read(&item, sizeof(directory_item)) != EOF) {
-        this->items.push_back(item);
+bool Directory::Iterator::next(directory_item& item) {
+    if (this->position == this->count) {
+        int64_t done = this->input.read(reinterpret_cast<char *>(this->buffer.data()), this->buffer.size() * sizeof(directory_item));
+        this->count = done > 0 ? (size_t) done / sizeof(directory_item) : 0;
+        this->position = 0;
+        if (this->count == 0) {
+            return false;
+        }
+    }
+    item = this->buffer[this->position++];
+    return true;
+}
+
+Directory::Iterator Directory::iterate() const {
+    return Iterator(this->inode, this->fileSystem);
+}
+
+size_t Directory::itemCount() const {
+    return (size_t) (this->inode->inode->file_size / (int64_t) sizeof(directory_item));
+}
+
+int32_t Directory::lookup(INode& directory, const std::string& name, FileSystem& fileSystem) {
+    // streams the directory a cluster at a time into a reused buffer and stops at the first match
+    thread_local std::vector<directory_item> buffer;
+    buffer.resize(fileSystem.clusterSize() / sizeof(directory_item));
+    MemoryIterator input(directory, fileSystem, false);
+    int64_t done;
+    while ((done = input.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(directory_item))) >= (int64_t) sizeof(directory_item)) {
+        for (size_t i = 0; i < (size_t) done / sizeof(directory_item); ++i) {
+            if (strncmp(name.c_str(), buffer[i].item_name, sizeof(buffer[i].item_name)) == 0) {
+                return buffer[i].inode;
+            }
+        }
     }
+    return -1;
 }
 
 const std::vector<directory_item> &Directory::getItems() const {
+    this->load();
     return items;
 }
 
 std::shared_ptr<INode> Directory::getItem(const std::string& name) {
+    if (!this->loaded) {
+        int32_t id = lookup(*this->inode, name, *this->fileSystem);
+        return id >= 0 ? this->fileSystem->getInode(id) : nullptr;
+    }
     for (const directory_item &item : this->items) {
         if (name == item.item_name) {
             std::shared_ptr<INode> out = this->fileSystem->getInode(item.inode);
@@ -35,14 +86,23 @@ std::shared_ptr<INode> Directory::getSelf() {
 }
 
 void Directory::addItem(const std::string& name, std::shared_ptr<INode> inode) {
-    directory_item newItem{.inode = inode->inode->node_id};
+    directory_item newItem{};
+    newItem.inode = inode->inode->node_id;
     strcpy(newItem.item_name, name.substr(0, 11).c_str());
 
-    this->items.push_back(newItem);
     if (inode->inode->isDirectory) {
         this->inode->inode->references++;
     }
-    this->save();
+    if (this->loaded) {
+        this->items.push_back(newItem);
+        this->save();
+        return;
+    }
+    // the new item goes to the end, the rest of the directory is not read
+    auto output = this->inode->getAppendStream(this->fileSystem);
+    output.sputn(reinterpret_cast<const char *>(&newItem), sizeof(directory_item));
+    output.close();
+    this->fileSystem->saveInode(this->inode->inode.get());
 }
 
 void Directory::save() {
@@ -55,6 +115,7 @@ void Directory::save() {
 }
 
 void Directory::removeItem(const std::string &name, bool decrementSelfReference) {
+    this->load();
     auto it = this->items.begin();
     while (it != this->items.end())
     {
@@ -71,11 +132,13 @@ void Directory::removeItem(const std::string &name, bool decrementSelfReference)
 }
 
 std::shared_ptr<Directory> Directory::getParent() {
-    return std::make_shared<Directory>(this->getItem(".."), this->fileSystem);
+    return makePooled<Directory>(this->getItem(".."), this->fileSystem);
 }
 
 std::string Directory::getNameByInode(std::shared_ptr<INode> inode) {
-    for (directory_item item : this->items) {
+    Iterator entries = this->iterate();
+    directory_item item{};
+    while (entries.next(item)) {
         if (item.inode == inode->inode->node_id) {
             return item.item_name;
         }
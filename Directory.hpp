@@ -7,8 +7,24 @@
 
 class Directory {
 public:
+    // entries one cluster at a time, straight from the directory file
+    class Iterator {
+    public:
+        Iterator(const std::shared_ptr<INode>& directory, const std::shared_ptr<FileSystem>& fileSystem);
+        bool next(directory_item& item);
+
+    private:
+        MemoryIterator input;
+        std::vector<directory_item> buffer;
+        size_t position = 0;
+        size_t count = 0;
+    };
+
     Directory(std::shared_ptr<INode> inode, std::shared_ptr<FileSystem> fileSystem);
+    static int32_t lookup(INode& directory, const std::string& name, FileSystem& fileSystem);
 
+    Iterator iterate() const;
+    size_t itemCount() const;
     const std::vector<directory_item> &getItems() const;
     std::shared_ptr<INode> getItem(const std::string& name);
     std::shared_ptr<INode> getSelf();
@@ -20,8 +36,10 @@ public:
 protected:
     std::shared_ptr<INode> inode;
     std::shared_ptr<FileSystem> fileSystem;
-    std::vector<directory_item> items;
+    mutable std::vector<directory_item> items;
+    mutable bool loaded = false;
 
+    void load() const;
     void save();
 };
 
@@ -1,66 +1,168 @@
 #include "FileSystem.hpp"
 #include "structs.hpp"
 #include "consts.hpp"
+#include "Crc32c.hpp"
 
 #include <utility>
-#include <zconf.h>
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <condition_variable>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <cstring>
 
+static void inodeFromV1(const pseudo_inode_v1& source, pseudo_inode* target) {
+    target->node_id = source.node_id;
+    target->isDirectory = source.isDirectory;
+    target->references = source.references;
+    target->flags = source.flags;
+    target->file_size = source.file_size;
+    if (source.flags & INODE_FLAG_INLINE) {
+        memcpy(target->direct, source.direct, INLINE_DATA_SIZE_V1);
+        return;
+    }
+    for (int i = 0; i < 5; ++i) {
+        target->direct[i] = source.direct[i];
+    }
+    target->indirect1 = source.indirect1;
+    target->indirect2 = source.indirect2;
+}
+
+static void inodeToV1(const pseudo_inode* source, pseudo_inode_v1& target) {
+    target.node_id = source->node_id;
+    target.isDirectory = source->isDirectory;
+    target.references = source->references;
+    target.flags = source->flags;
+    target.file_size = (int32_t) source->file_size;
+    if (source->flags & INODE_FLAG_INLINE) {
+        memcpy(target.direct, source->direct, INLINE_DATA_SIZE_V1);
+        return;
+    }
+    for (int i = 0; i < 5; ++i) {
+        target.direct[i] = (int32_t) source->direct[i];
+    }
+    target.indirect1 = (int32_t) source->indirect1;
+    target.indirect2 = (int32_t) source->indirect2;
+}
+
 FileSystem::FileSystem(std::string realFile) {
-    this->realFile = std::move(realFile);
+    // comma separated files form one striped volume
+    size_t start = 0;
+    while (true) {
+        size_t comma = realFile.find(',', start);
+        this->members.push_back(realFile.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+    this->openedFiles.assign(this->members.size(), -1);
+    if (this->members.size() > 1) {
+        this->ioPool.reset(new ThreadPool(this->members.size()));
+    }
 }
 
-int FileSystem::format(unsigned long byteSize) {
-    FILE * pFile = fopen(this->realFile.c_str(), "w");
-    fclose(pFile);
-    pFile = getFile();
-    ftruncate(fileno(pFile), byteSize);
+FileSystem::~FileSystem() {
+    if (!this->groups.empty()) {
+        this->discardPending();
+        this->syncChecksums();
+        this->saveSuperblock();
+    }
+    this->releaseFile();
+}
+
+int FileSystem::format(uint64_t byteSize, int32_t clusterSize, int32_t stripeUnit) {
+    if (clusterSize < MIN_CLUSTER_SIZE || clusterSize > MAX_CLUSTER_SIZE || (clusterSize & (clusterSize - 1)) != 0) {
+        return 1;
+    }
+    // a cluster never spans two member files
+    if (stripeUnit < clusterSize || stripeUnit % clusterSize != 0) {
+        return 3;
+    }
 
     superblock super_block{};
+    super_block.magic = SUPERBLOCK_MAGIC;
+    super_block.version = FS_VERSION;
     super_block.disk_size = byteSize;
+    super_block.cluster_size = clusterSize;
+    super_block.group_table_address = SUPERBLOCK_SIZE;
 
-    long leftSize = byteSize - SUPERBLOCK_SIZE;
-    long inodeSize = leftSize / (CLUSTER_SIZE_PER_INODE_SIZE + 1);
-    long dataSize = leftSize - inodeSize;
-
-    int inodeCount = (int) ((inodeSize * 8) / (INODE_SIZE * 8 + 1));
-    int inodeMapSize = inodeCount / 8 + (inodeCount % 8 == 0 ? 0 : 1);
+    super_block.features = FEATURE_CHECKSUMS;
+    super_block.stripe_unit = stripeUnit;
+    super_block.stripe_count = (int32_t) this->members.size();
 
-    if (inodeMapSize + INODE_SIZE * inodeCount > inodeSize) {
-        inodeCount--;
-        inodeMapSize = inodeCount / 8 + (inodeCount % 8 == 0 ? 0 : 1);
+    // every cluster costs its data, a bitmap bit, its checksum and a share of the inode table
+    int64_t leftSize = byteSize - SUPERBLOCK_SIZE - sizeof(group_descriptor);
+    int64_t clusterCost = (int64_t) clusterSize * 8 + 1 + CHECKSUM_SIZE * 8 + ((int64_t) clusterSize * 8) / CLUSTER_SIZE_PER_INODE_SIZE;
+    int64_t clustersPerGroup = (leftSize * 8) / clusterCost;
+    if (clustersPerGroup > (int64_t) clusterSize * 8) {
+        clustersPerGroup = (int64_t) clusterSize * 8;
+    }
+    int64_t inodesPerGroup = (clustersPerGroup * clusterSize / CLUSTER_SIZE_PER_INODE_SIZE) / INODE_SIZE;
+    inodesPerGroup -= inodesPerGroup % 8;
+    if (inodesPerGroup < 8) {
+        inodesPerGroup = 8;
     }
 
-    int clusterCount = (int) ((dataSize * 8) / (CLUSTER_SIZE * 8 + 1));
-    int clusterMapSize = clusterCount / 8 + (clusterCount % 8 == 0 ? 0 : 1);
-
-//    std::cout << inodeCount << ": " << inodeMapSize << " : " << clusterCount << ": " << clusterMapSize << std::endl;
+    int64_t inodeMapSize = inodesPerGroup / 8;
+    int64_t clusterMapSize = clustersPerGroup / 8 + (clustersPerGroup % 8 == 0 ? 0 : 1);
+    int64_t metadataSize = inodeMapSize + clusterMapSize + inodesPerGroup * INODE_SIZE + clustersPerGroup * CHECKSUM_SIZE;
+    metadataSize = (metadataSize + clusterSize - 1) / clusterSize * clusterSize;
+    int64_t groupSize = metadataSize + clustersPerGroup * clusterSize;
 
-    if (clusterMapSize + CLUSTER_SIZE * clusterCount > clusterCount) {
-        clusterCount--;
-        clusterMapSize = clusterCount / 8 + (clusterCount % 8 == 0 ? 0 : 1);
+    int64_t maxGroups = byteSize / groupSize + 1;
+    int64_t firstGroup = super_block.group_table_address + maxGroups * (int64_t) sizeof(group_descriptor);
+    firstGroup = (firstGroup + clusterSize - 1) / clusterSize * clusterSize;
+    if (clustersPerGroup <= 0 || firstGroup + metadataSize + clusterSize > (int64_t) byteSize) {
+        return 2;
     }
 
-    super_block.cluster_count = clusterCount;
-    super_block.inode_count = inodeCount;
-    super_block.bitmapi_start_address = SUPERBLOCK_SIZE + 1;
-    super_block.bitmap_start_address = super_block.bitmapi_start_address + inodeMapSize;
-    super_block.inode_start_address = super_block.bitmap_start_address + clusterMapSize;
-    super_block.data_start_address = super_block.inode_start_address + inodeCount * INODE_SIZE;
+    super_block.inodes_per_group = (int32_t) inodesPerGroup;
+    super_block.clusters_per_group = clustersPerGroup;
+    super_block.group_size = groupSize;
+    super_block.first_group_address = firstGroup;
+    super_block.group_capacity = (int32_t) maxGroups;
+
     this->super_block = super_block;
+    this->stripe_unit = stripeUnit;
+    this->updateClusterGeometry();
+    this->groups.clear();
 
-    this->inodeBitmap.resize(super_block.inode_count, false);
-    this->clusterBitmap.resize(super_block.cluster_count, false);
+    int64_t groupStart = firstGroup;
+    while (groupStart + metadataSize + clusterSize <= (int64_t) byteSize && this->super_block.inode_count <= INT32_MAX - inodesPerGroup) {
+        auto group = std::make_shared<Group>();
+        group->index = (int32_t) this->groups.size();
+        group_descriptor &descriptor = group->descriptor;
+        descriptor.bitmapi_start_address = groupStart;
+        descriptor.bitmap_start_address = groupStart + inodeMapSize;
+        descriptor.inode_start_address = descriptor.bitmap_start_address + clusterMapSize;
+        descriptor.data_start_address = groupStart + metadataSize;
+        descriptor.inode_count = (int32_t) inodesPerGroup;
+        descriptor.free_inodes = descriptor.inode_count;
+        descriptor.cluster_count = ((int64_t) byteSize - descriptor.data_start_address) / clusterSize;
+        if (descriptor.cluster_count > clustersPerGroup) {
+            descriptor.cluster_count = clustersPerGroup;
+        }
+        descriptor.free_clusters = descriptor.cluster_count;
+        group->inodeBitmap.assign(descriptor.inode_count, false);
+        group->clusterBitmap.assign(descriptor.cluster_count, false);
+        group->checksums.assign(descriptor.cluster_count, 0);
 
-//    std::cout << super_block.inode_count << ": " << super_block.inode_start_address << " : " << super_block.cluster_count << ": " << super_block.data_start_address << std::endl;
+        this->super_block.inode_count += descriptor.inode_count;
+        this->super_block.cluster_count += descriptor.cluster_count;
+        this->groups.push_back(group);
+        groupStart += groupSize;
+    }
+    this->super_block.group_count = (int32_t) this->groups.size();
+    this->recount();
 
-    fseek(pFile, 0, SEEK_SET);
-    fwrite(&super_block, SUPERBLOCK_SIZE, 1, pFile);
+    this->create((int64_t) byteSize);
 
-    char empty = '\0';
-    for (uint32_t i = super_block.bitmapi_start_address; i < super_block.inode_start_address; ++i) {
-        fseek(pFile, i, SEEK_SET);
-        fwrite(&empty, 1, 1, pFile);
+    this->write(&this->super_block, SUPERBLOCK_SIZE, 0);
+    for (const auto &group : this->groups) {
+        this->saveGroup(*group);
     }
 
     auto inode = createInode();
@@ -75,135 +177,953 @@ int FileSystem::format(unsigned long byteSize) {
     strcpy(root.item_name, "..");
     stream.sputn(reinterpret_cast<const char *>(&root), sizeof(directory_item));
     stream.close();
+    this->saveSuperblock();
 
-    releaseFile();
     return 0;
 }
 
-void FileSystem::load() {
-    FILE * pFile = getFile();
-    fseek(pFile, 0, SEEK_SET);
-    fread(&this->super_block, SUPERBLOCK_SIZE, 1, pFile);
+int FileSystem::grow(uint64_t byteSize) {
+    if (this->super_block.version == 1) {
+        return 1;
+    }
+    if ((int64_t) byteSize <= this->super_block.disk_size) {
+        return 2;
+    }
+
+    superblock previous = this->super_block;
+    Group &last = *this->groups.back();
+    group_descriptor previousLast = last.descriptor;
+    size_t previousGroups = this->groups.size();
+    int64_t clusterSize = this->clusterSize();
+    int64_t clustersPerGroup = this->super_block.clusters_per_group;
+    int64_t inodeMapSize = this->super_block.inodes_per_group / 8;
+    int64_t clusterMapSize = clustersPerGroup / 8 + (clustersPerGroup % 8 == 0 ? 0 : 1);
+    int64_t metadataSize = this->super_block.group_size - (clustersPerGroup << this->cluster_shift);
+    this->extend((int64_t) byteSize);
 
-//    std::cout << this->super_block.inode_count << ": " << this->super_block.inode_start_address << " : " << this->super_block.cluster_count << ": " << this->super_block.data_start_address << std::endl;
+    // the last group gets the clusters it lacked, its bitmap and checksums already have room for them
+    {
+        std::lock_guard<std::mutex> lock(last.mutex);
+        int64_t count = std::min(clustersPerGroup, ((int64_t) byteSize - last.descriptor.data_start_address) >> this->cluster_shift);
+        if (count > last.descriptor.cluster_count) {
+            int64_t added = count - last.descriptor.cluster_count;
+            last.descriptor.cluster_count = count;
+            last.descriptor.free_clusters += added;
+            last.clusterBitmap.resize(count, false);
+            if (this->checksums()) {
+                last.checksums.resize(count, 0);
+            }
+            this->super_block.cluster_count += added;
+        }
+    }
 
-    this->inodeBitmap.resize(this->super_block.inode_count);
-    this->clusterBitmap.resize(this->super_block.cluster_count);
-    int mask = 0;
-    char byte;
-    int32_t mapAddress = this->super_block.bitmapi_start_address;
+    // new groups follow - the sparse extension already reads as empty bitmaps and checksums
+    int64_t groupStart = this->super_block.first_group_address + (int64_t) this->groups.size() * this->super_block.group_size;
+    while (groupStart + metadataSize + clusterSize <= (int64_t) byteSize && this->super_block.inode_count <= INT32_MAX - this->super_block.inodes_per_group) {
+        auto group = std::make_shared<Group>();
+        group->index = (int32_t) this->groups.size();
+        group_descriptor &descriptor = group->descriptor;
+        descriptor.bitmapi_start_address = groupStart;
+        descriptor.bitmap_start_address = groupStart + inodeMapSize;
+        descriptor.inode_start_address = descriptor.bitmap_start_address + clusterMapSize;
+        descriptor.data_start_address = groupStart + metadataSize;
+        descriptor.inode_count = this->super_block.inodes_per_group;
+        descriptor.free_inodes = descriptor.inode_count;
+        descriptor.cluster_count = std::min(clustersPerGroup, ((int64_t) byteSize - descriptor.data_start_address) >> this->cluster_shift);
+        descriptor.free_clusters = descriptor.cluster_count;
+        group->inodeBitmap.assign(descriptor.inode_count, false);
+        group->clusterBitmap.assign(descriptor.cluster_count, false);
+        if (this->checksums()) {
+            group->checksums.assign(descriptor.cluster_count, 0);
+        }
+
+        this->super_block.inode_count += descriptor.inode_count;
+        this->super_block.cluster_count += descriptor.cluster_count;
+        this->groups.push_back(group);
+        groupStart += this->super_block.group_size;
+    }
+    this->super_block.group_count = (int32_t) this->groups.size();
+    this->super_block.disk_size = (int64_t) byteSize;
+    this->recount();
 
-    for (int i = 0; i < this->super_block.inode_count; ++i) {
-        if (mask == 0) {
-            mask = 1<<7;
-            fseek(pFile, mapAddress++, SEEK_SET);
-            fread(&byte, 1, 1, pFile);
+    // the table is moved only when it is full, so the time stays proportional to the added space
+    int64_t previousTable = previous.group_table_address >= previous.first_group_address ? previous.group_table_address : -1;
+    int64_t previousCapacity = this->groupCapacity();
+    if ((int64_t) this->groups.size() > previousCapacity && !this->relocateGroupTable()) {
+        this->groups.resize(previousGroups);
+        last.descriptor = previousLast;
+        last.clusterBitmap.resize(previousLast.cluster_count);
+        if (this->checksums()) {
+            last.checksums.resize(previousLast.cluster_count);
         }
-        if (this->inodeBitmap[i]) {
-//            std::cout << "INODE - " << i << " - ON" << std::endl;
+        this->super_block = previous;
+        this->extend(previous.disk_size);
+        return 3;
+    }
+    for (size_t i = previousGroups - 1; i < this->groups.size(); ++i) {
+        this->saveGroup(*this->groups[i]);
+    }
+    this->saveSuperblock();
+
+    // clusters of a table moved before are free now
+    if (previousTable != -1 && this->super_block.group_table_address != previousTable) {
+        int64_t count = (previousCapacity * (int64_t) sizeof(group_descriptor) + clusterSize - 1) >> this->cluster_shift;
+        for (int64_t i = 0; i < count; ++i) {
+            this->removeClusterByAddress(previousTable + (i << this->cluster_shift));
         }
-        this->inodeBitmap[i] = (byte & mask) > 0;
-        mask >>= 1;
     }
+    return 0;
+}
+
+int64_t FileSystem::groupCapacity() const {
+    return this->super_block.group_capacity;
+}
+
+bool FileSystem::relocateGroupTable() {
+    // the full table goes to a run of data clusters with room to double, preferably in the new groups
+    int64_t capacity = (int64_t) this->groups.size() * 2;
+    int64_t count = (capacity * (int64_t) sizeof(group_descriptor) + this->clusterSize() - 1) >> this->cluster_shift;
+    int64_t address = this->findFreeRun(count, this->groups.back()->descriptor.data_start_address);
+    if (address == -1) {
+        return false;
+    }
+    int64_t previousTable = this->super_block.group_table_address;
+    int32_t previousCapacity = this->super_block.group_capacity;
+    this->super_block.group_table_address = address;
+    this->super_block.group_capacity = (int32_t) capacity;
+    if (!this->allocateRun(address, count)) {
+        this->super_block.group_table_address = previousTable;
+        this->super_block.group_capacity = previousCapacity;
+        return false;
+    }
+    for (const auto &group : this->groups) {
+        this->saveGroup(*group);
+    }
+    return true;
+}
+
+std::vector<int64_t> FileSystem::groupTableClusters() const {
+    // only a table moved by grow lives in the data area
+    std::vector<int64_t> clusters;
+    if (this->super_block.version == 1 || this->super_block.group_table_address < this->super_block.first_group_address) {
+        return clusters;
+    }
+    int64_t count = (this->groupCapacity() * (int64_t) sizeof(group_descriptor) + this->clusterSize() - 1) >> this->cluster_shift;
+    for (int64_t i = 0; i < count; ++i) {
+        clusters.push_back(this->super_block.group_table_address + (i << this->cluster_shift));
+    }
+    return clusters;
+}
+
+void FileSystem::extend(int64_t byteSize) {
+    for (size_t i = 0; i < this->members.size(); ++i) {
+        ftruncate(this->getFile(i), this->memberSize(i, byteSize));
+    }
+}
+
+void FileSystem::create(int64_t byteSize) {
+    // sparse image - unwritten parts read as zeros
+    this->releaseFile();
+    for (size_t i = 0; i < this->members.size(); ++i) {
+        this->openedFiles[i] = open(this->members[i].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        ftruncate(this->openedFiles[i], this->memberSize(i, byteSize));
+    }
+}
 
-    mask = 0;
-    mapAddress = this->super_block.bitmap_start_address;
-    for (int i = 0; i < this->super_block.cluster_count; ++i) {
-        if (mask == 0) {
-            mask = 1<<7;
-            fseek(pFile, mapAddress++, SEEK_SET);
-            fread(&byte, 1, 1, pFile);
+int64_t FileSystem::imageSize() {
+    int64_t size = 0;
+    for (size_t i = 0; i < this->members.size(); ++i) {
+        struct stat info{};
+        if (fstat(this->getFile(i), &info) == 0) {
+            size += info.st_size;
         }
-        this->clusterBitmap[i] = (byte & mask) > 0;
-        if (this->clusterBitmap[i]) {
-//            std::cout << "CLUSTER - " << i << " - ON" << std::endl;
+    }
+    return size;
+}
+
+bool FileSystem::exists() const {
+    for (const std::string &member : this->members) {
+        if (access(member.c_str(), R_OK) != 0) {
+            return false;
         }
-        mask >>= 1;
     }
+    return true;
+}
+
+int32_t FileSystem::stripeUnit() const {
+    return this->stripe_unit;
+}
 
-    releaseFile();
+int32_t FileSystem::stripeCount() const {
+    return (int32_t) this->members.size();
 }
 
-std::shared_ptr<INode> FileSystem::createInode() {
-    for (int i = 0; i < this->inodeBitmap.size(); ++i) {
-        if (!this->inodeBitmap[i]) {
-            this->inodeBitmap[i] = true;
-            this->setBit(i, true, this->super_block.bitmapi_start_address);
+std::vector<std::pair<int64_t, int64_t>> FileSystem::usedExtents() {
+    // superblock, group table, bitmaps, used inode records and used clusters
+    std::vector<std::pair<int64_t, int64_t>> extents;
+    auto add = [&extents](int64_t address, int64_t length) {
+        if (!extents.empty() && extents.back().first + extents.back().second == address) {
+            extents.back().second += length;
+        } else {
+            extents.emplace_back(address, length);
+        }
+    };
+
+    if (this->super_block.version == 1) {
+        add(0, SUPERBLOCK_SIZE_V1);
+    } else if (this->super_block.group_table_address >= this->super_block.first_group_address) {
+        // group table moved by grow - its clusters are marked used in the bitmap
+        add(0, SUPERBLOCK_SIZE);
+    } else {
+        add(0, this->super_block.group_table_address + this->super_block.group_count * (int64_t) sizeof(group_descriptor));
+    }
+    int32_t recordSize = this->inodeRecordSize();
+    for (const auto &group : this->groups) {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        const group_descriptor &descriptor = group->descriptor;
+        add(descriptor.bitmapi_start_address, descriptor.inode_start_address - descriptor.bitmapi_start_address);
+        for (int64_t i = 0; i < descriptor.inode_count; ++i) {
+            if (group->inodeBitmap[i]) {
+                add(descriptor.inode_start_address + i * recordSize, recordSize);
+            }
+        }
+        if (this->checksums()) {
+            add(this->checksumAddress(*group), descriptor.cluster_count * CHECKSUM_SIZE);
+        }
+        for (int64_t i = 0; i < descriptor.cluster_count; ++i) {
+            if (group->clusterBitmap[i]) {
+                add(descriptor.data_start_address + (i << this->cluster_shift), this->clusterSize());
+            }
+        }
+    }
+    return extents;
+}
 
-            std::shared_ptr<pseudo_inode> inode = std::make_shared<pseudo_inode>();
-            inode->node_id = i;
-            inode->file_size = 0;
-            this->saveInode(inode.get());
+int FileSystem::load() {
+    uint32_t magic = 0;
+    this->read(&magic, sizeof(uint32_t), 0);
+    this->groups.clear();
 
-            return std::make_shared<INode>(inode);
+    if (magic == SUPERBLOCK_MAGIC) {
+        this->read(&this->super_block, SUPERBLOCK_SIZE, 0);
+        // the volume has to be opened with the member files it was formatted with
+        if (this->super_block.stripe_count != (int32_t) this->members.size()) {
+            return 1;
+        }
+        this->stripe_unit = this->super_block.stripe_unit;
+        for (int32_t i = 0; i < this->super_block.group_count; ++i) {
+            auto group = std::make_shared<Group>();
+            group->index = i;
+            this->read(&group->descriptor, sizeof(group_descriptor), this->super_block.group_table_address + i * (int64_t) sizeof(group_descriptor));
+            this->groups.push_back(group);
+        }
+    } else {
+        // v1 image - 32-bit addresses, no magic, one allocation group
+        if (this->members.size() != 1) {
+            return 1;
+        }
+        superblock_v1 old{};
+        this->read(&old, SUPERBLOCK_SIZE_V1, 0);
+        this->super_block = superblock{};
+        this->super_block.version = 1;
+        this->super_block.cluster_size = CLUSTER_SIZE;
+        this->super_block.disk_size = old.disk_size;
+        this->super_block.inode_count = old.inode_count;
+        this->super_block.cluster_count = old.cluster_count;
+        this->super_block.group_count = 1;
+        this->super_block.inodes_per_group = old.inode_count;
+        this->super_block.clusters_per_group = old.cluster_count;
+
+        auto group = std::make_shared<Group>();
+        group->index = 0;
+        group->descriptor.bitmapi_start_address = old.bitmapi_start_address;
+        group->descriptor.bitmap_start_address = old.bitmap_start_address;
+        group->descriptor.inode_start_address = old.inode_start_address;
+        group->descriptor.data_start_address = old.data_start_address;
+        group->descriptor.inode_count = old.inode_count;
+        group->descriptor.cluster_count = old.cluster_count;
+        this->groups.push_back(group);
+    }
+
+    this->updateClusterGeometry();
+
+    for (const auto &group : this->groups) {
+        group_descriptor &descriptor = group->descriptor;
+        group->inodeBitmap.assign(descriptor.inode_count, false);
+        group->clusterBitmap.assign(descriptor.cluster_count, false);
+
+        std::vector<unsigned char> map(descriptor.inode_start_address - descriptor.bitmapi_start_address);
+        this->read(map.data(), map.size(), descriptor.bitmapi_start_address);
+
+        group_descriptor stored = descriptor;
+        descriptor.free_inodes = 0;
+        for (int64_t i = 0; i < descriptor.inode_count; ++i) {
+            group->inodeBitmap[i] = (map[i / 8] & (1 << (7 - (i % 8)))) != 0;
+            descriptor.free_inodes += group->inodeBitmap[i] ? 0 : 1;
+        }
+
+        int64_t offset = descriptor.bitmap_start_address - descriptor.bitmapi_start_address;
+        descriptor.free_clusters = 0;
+        for (int64_t i = 0; i < descriptor.cluster_count; ++i) {
+            group->clusterBitmap[i] = (map[offset + i / 8] & (1 << (7 - (i % 8)))) != 0;
+            descriptor.free_clusters += group->clusterBitmap[i] ? 0 : 1;
+        }
+
+        if (this->checksums()) {
+            group->checksums.assign(descriptor.cluster_count, 0);
+            this->read(group->checksums.data(), descriptor.cluster_count * CHECKSUM_SIZE, this->checksumAddress(*group));
+        }
+        group->dirty.clear();
+
+        // the bitmaps are authoritative - stale counters are repaired
+        if (stored.free_inodes != descriptor.free_inodes || stored.free_clusters != descriptor.free_clusters) {
+            this->saveGroup(*group);
+        }
+    }
+
+    superblock stored = this->super_block;
+    this->recount();
+    if (stored.free_inodes != this->super_block.free_inodes || stored.used_inodes != this->super_block.used_inodes
+        || stored.free_clusters != this->super_block.free_clusters || stored.used_clusters != this->super_block.used_clusters) {
+        this->saveSuperblock();
+    }
+    return 0;
+}
+
+std::shared_ptr<INode> FileSystem::createInode(int32_t parent) {
+    // prefer the group of the parent directory
+    size_t first = parent >= 0 ? parent / this->super_block.inodes_per_group : 0;
+    for (size_t g = 0; g < this->groups.size(); ++g) {
+        Group &group = *this->groups[(first + g) % this->groups.size()];
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (group.descriptor.free_inodes <= 0) {
+            continue;
+        }
+        for (size_t i = 0; i < group.inodeBitmap.size(); ++i) {
+            if (!group.inodeBitmap[i]) {
+                group.inodeBitmap[i] = true;
+                group.descriptor.free_inodes--;
+                this->account(1, 0);
+                this->setBit(i, true, group.descriptor.bitmapi_start_address);
+                this->saveGroup(group);
+
+                std::shared_ptr<pseudo_inode> inode = makePooled<pseudo_inode>();
+                inode->node_id = group.index * this->super_block.inodes_per_group + i;
+                inode->file_size = 0;
+                inode->flags = INODE_FLAG_INLINE;
+                this->saveInode(inode.get());
+
+                return makePooled<INode>(inode);
+            }
         }
     }
     return nullptr;
 }
 
 std::shared_ptr<INode> FileSystem::getInode(int index) {
-    if (this->inodeBitmap[index]) {
-        int32_t address = this->super_block.inode_start_address + (index * sizeof(pseudo_inode));
-        std::shared_ptr<pseudo_inode> inode = std::make_shared<pseudo_inode>();
-        this->read((void *) inode.get(), sizeof(pseudo_inode), address);
+    std::shared_ptr<pseudo_inode> inode = makePooled<pseudo_inode>();
+    if (!this->readInode(index, *inode)) {
+        return nullptr;
+    }
+    return makePooled<INode>(inode);
+}
 
-        return std::make_shared<INode>(inode);
+bool FileSystem::readInode(int index, pseudo_inode& inode) {
+    // into the caller's record - nothing is allocated
+    if (index < 0 || index >= this->super_block.inode_count) {
+        return false;
     }
-    return nullptr;
+    Group &group = *this->groups[index / this->super_block.inodes_per_group];
+    int local = index % this->super_block.inodes_per_group;
+    {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (!group.inodeBitmap[local]) {
+            return false;
+        }
+    }
+    int64_t address = group.descriptor.inode_start_address + ((int64_t) local * this->inodeRecordSize());
+    if (this->super_block.version == 1) {
+        pseudo_inode_v1 old{};
+        this->read((void *) &old, INODE_SIZE_V1, address);
+        inodeFromV1(old, &inode);
+    } else {
+        this->read((void *) &inode, INODE_SIZE, address);
+    }
+    return true;
 }
 
-int32_t FileSystem::createCluster() {
-    for (int i = 0; i < this->clusterBitmap.size(); ++i) {
-        if (!this->clusterBitmap[i]) {
-            this->clusterBitmap[i] = true;
-            this->setBit(i, true, this->super_block.bitmap_start_address);
-//            std::cout << "CREATING CLUSTER - " << i << " - ADDRESS - " << (i*CLUSTER_SIZE) << " - REAL ADDRESS - " << (this->super_block.data_start_address + (i*CLUSTER_SIZE)) << std::endl;
-            return this->super_block.data_start_address + (i*CLUSTER_SIZE);
+std::vector<std::shared_ptr<INode>> FileSystem::createInodes(int32_t count, int32_t parent) {
+    // records are not written - the caller commits them with saveInodes
+    std::vector<std::shared_ptr<INode>> inodes;
+    size_t first = parent >= 0 ? parent / this->super_block.inodes_per_group : 0;
+    for (size_t g = 0; g < this->groups.size() && (int32_t) inodes.size() < count; ++g) {
+        Group &group = *this->groups[(first + g) % this->groups.size()];
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (group.descriptor.free_inodes <= 0) {
+            continue;
+        }
+        int64_t from = -1;
+        int64_t to = -1;
+        int32_t free = group.descriptor.free_inodes;
+        for (size_t i = 0; i < group.inodeBitmap.size() && (int32_t) inodes.size() < count; ++i) {
+            if (group.inodeBitmap[i]) {
+                continue;
+            }
+            group.inodeBitmap[i] = true;
+            group.descriptor.free_inodes--;
+            from = from == -1 ? (int64_t) i : from;
+            to = i;
+
+            std::shared_ptr<pseudo_inode> inode = makePooled<pseudo_inode>();
+            inode->node_id = group.index * this->super_block.inodes_per_group + i;
+            inode->flags = INODE_FLAG_INLINE;
+            inodes.push_back(makePooled<INode>(inode));
+        }
+        if (from != -1) {
+            this->account(free - group.descriptor.free_inodes, 0);
+            this->writeBits(group.inodeBitmap, from, to - from + 1, group.descriptor.bitmapi_start_address);
+            this->saveGroup(group);
+        }
+    }
+    return inodes;
+}
+
+int64_t FileSystem::createCluster(int64_t goal) {
+    // search from the goal (usually the previous cluster of the file) onwards
+    size_t first = 0;
+    int64_t start = 0;
+    if (goal >= 0) {
+        first = this->groupOfAddress(goal);
+        start = (goal - this->groups[first]->descriptor.data_start_address) >> this->cluster_shift;
+        if (start < 0) {
+            start = 0;
+        }
+    }
+    for (size_t g = 0; g <= this->groups.size(); ++g) {
+        Group &group = *this->groups[(first + g) % this->groups.size()];
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (group.descriptor.free_clusters <= 0) {
+            continue;
+        }
+        int64_t count = group.descriptor.cluster_count;
+        int64_t from = g == 0 ? start : 0;
+        int64_t to = g == this->groups.size() ? start : count;
+        for (int64_t i = from; i < to; ++i) {
+            if (!group.clusterBitmap[i]) {
+                group.clusterBitmap[i] = true;
+                group.descriptor.free_clusters--;
+                this->account(0, 1);
+                this->setBit(i, true, group.descriptor.bitmap_start_address);
+                this->saveGroup(group);
+                int64_t address = group.descriptor.data_start_address + (i << this->cluster_shift);
+                // old contents until the first write
+                if (this->checksums()) {
+                    this->markDirty(address, this->clusterSize());
+                }
+                return address;
+            }
         }
     }
     return -1;
 }
 
-void FileSystem::read(void* buffer, size_t size, int32_t address) {
-    FILE * pFile = getFile();
-    fseek(pFile, address, SEEK_SET);
-    fread(buffer, size, 1, pFile);
-    releaseFile();
+int64_t FileSystem::inodeGoal(int32_t nodeId) const {
+    return this->groups[nodeId / this->super_block.inodes_per_group]->descriptor.data_start_address;
 }
 
-void FileSystem::write(void *buffer, size_t size, int32_t address) {
-    FILE * pFile = getFile();
-    fseek(pFile, address, SEEK_SET);
-//    std::cout << "WRITING - " << address << " - " << size << std::endl;
-    fwrite(buffer, size, 1, pFile);
-    releaseFile();
+int64_t FileSystem::findFreeRun(int64_t count, int64_t goal) {
+    size_t first = goal >= 0 ? this->groupOfAddress(goal) : 0;
+    for (size_t g = 0; g < this->groups.size(); ++g) {
+        Group &group = *this->groups[(first + g) % this->groups.size()];
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (group.descriptor.free_clusters < count) {
+            continue;
+        }
+        int64_t run = 0;
+        for (int64_t i = 0; i < group.descriptor.cluster_count; ++i) {
+            run = group.clusterBitmap[i] ? 0 : run + 1;
+            if (run == count) {
+                return group.descriptor.data_start_address + ((i - count + 1) << this->cluster_shift);
+            }
+        }
+    }
+    return -1;
+}
+
+bool FileSystem::allocateRun(int64_t address, int64_t count) {
+    Group &group = *this->groups[this->groupOfAddress(address)];
+    int64_t local = (address - group.descriptor.data_start_address) >> this->cluster_shift;
+
+    std::lock_guard<std::mutex> lock(group.mutex);
+    if (local < 0 || local + count > group.descriptor.cluster_count) {
+        return false;
+    }
+    for (int64_t i = local; i < local + count; ++i) {
+        if (group.clusterBitmap[i]) {
+            return false;
+        }
+    }
+    for (int64_t i = local; i < local + count; ++i) {
+        group.clusterBitmap[i] = true;
+    }
+    group.descriptor.free_clusters -= count;
+    this->account(0, count);
+    this->writeBits(group.clusterBitmap, local, count, group.descriptor.bitmap_start_address);
+    this->saveGroup(group);
+    if (this->checksums()) {
+        this->markDirty(address, (size_t) (count << this->cluster_shift));
+    }
+    return true;
+}
+
+int64_t FileSystem::largestFreeRun() {
+    int64_t largest = 0;
+    for (const auto &group : this->groups) {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        int64_t run = 0;
+        for (int64_t i = 0; i < group->descriptor.cluster_count; ++i) {
+            run = group->clusterBitmap[i] ? 0 : run + 1;
+            largest = run > largest ? run : largest;
+        }
+    }
+    return largest;
+}
+
+int64_t FileSystem::freeClusters() {
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    return this->super_block.free_clusters;
+}
+
+int64_t FileSystem::freeInodes() {
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    return this->super_block.free_inodes;
+}
+
+int64_t FileSystem::usedClusters() {
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    return this->super_block.used_clusters;
+}
+
+int64_t FileSystem::usedInodes() {
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    return this->super_block.used_inodes;
+}
+
+int64_t FileSystem::clusterCount() const {
+    return this->super_block.cluster_count;
+}
+
+int64_t FileSystem::linkClusterCount(int64_t dataClusters) const {
+    // same shape as MemoryIterator::assignClusters builds
+    int64_t count = 0;
+    int64_t start = 5;
+    int64_t capacity = 1;
+    for (int32_t level = 1; level <= this->indirectLevels() && start < dataClusters; ++level) {
+        capacity *= this->linksPerCluster();
+        int64_t onLevel = dataClusters - start < capacity ? dataClusters - start : capacity;
+        int64_t span = 1;
+        for (int32_t depth = 1; depth <= level; ++depth) {
+            span *= this->linksPerCluster();
+            count += (onLevel + span - 1) / span;
+        }
+        start += capacity;
+    }
+    return count;
+}
+
+int64_t FileSystem::fileClusterCount(int64_t size) const {
+    // data and links of a file - none while it fits in the inode
+    if (size <= this->inlineDataSize()) {
+        return 0;
+    }
+    int64_t count = (size + this->clusterSize() - 1) >> this->clusterShift();
+    return count + this->linkClusterCount(count);
+}
+
+int32_t FileSystem::inodeCount() const {
+    return this->super_block.inode_count;
+}
+
+int32_t FileSystem::inodesPerGroup() const {
+    return this->super_block.inodes_per_group;
+}
+
+bool FileSystem::isInodeUsed(int32_t nodeId) const {
+    if (nodeId < 0 || nodeId >= this->super_block.inode_count) {
+        return false;
+    }
+    Group &group = *this->groups[nodeId / this->super_block.inodes_per_group];
+    std::lock_guard<std::mutex> lock(group.mutex);
+    return group.inodeBitmap[nodeId % this->super_block.inodes_per_group];
+}
+
+std::vector<std::shared_ptr<INode>> FileSystem::getInodes(const std::vector<int32_t>& ids) {
+    // sorted ids are read in runs covering the inode table - small gaps are read through
+    const int32_t maxGap = 64;
+    std::vector<int32_t> wanted;
+    for (int32_t id : ids) {
+        if (id >= 0 && id < this->super_block.inode_count && this->isInodeUsed(id)) {
+            wanted.push_back(id);
+        }
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+    std::map<int32_t, std::shared_ptr<INode>> found;
+    size_t i = 0;
+    while (i < wanted.size()) {
+        int32_t first = wanted[i];
+        int32_t group = first / this->super_block.inodes_per_group;
+        size_t last = i;
+        while (last + 1 < wanted.size() && wanted[last + 1] - wanted[last] <= maxGap
+               && wanted[last + 1] / this->super_block.inodes_per_group == group) {
+            last++;
+        }
+        std::vector<pseudo_inode> records = this->readInodes(first, wanted[last] - first + 1);
+        for (size_t j = i; j <= last; ++j) {
+            found[wanted[j]] = makePooled<INode>(makePooled<pseudo_inode>(records[wanted[j] - first]));
+        }
+        i = last + 1;
+    }
+
+    std::vector<std::shared_ptr<INode>> inodes;
+    for (int32_t id : ids) {
+        auto inode = found.find(id);
+        inodes.push_back(inode != found.end() ? inode->second : nullptr);
+    }
+    return inodes;
+}
+
+std::vector<pseudo_inode> FileSystem::readInodes(int32_t first, int32_t count) {
+    // one read for a run of inodes - the run must not cross a group
+    const Group &group = *this->groups[first / this->super_block.inodes_per_group];
+    int64_t address = group.descriptor.inode_start_address + (int64_t) (first % this->super_block.inodes_per_group) * this->inodeRecordSize();
+    std::vector<pseudo_inode> inodes(count);
+    if (this->super_block.version == 1) {
+        std::vector<pseudo_inode_v1> old(count);
+        this->read(old.data(), count * (size_t) INODE_SIZE_V1, address);
+        for (int32_t i = 0; i < count; ++i) {
+            inodeFromV1(old[i], &inodes[i]);
+        }
+        return inodes;
+    }
+    this->read(inodes.data(), count * (size_t) INODE_SIZE, address);
+    return inodes;
+}
+
+int64_t FileSystem::clusterIndexCount() const {
+    return (int64_t) this->groups.size() * this->super_block.clusters_per_group;
+}
+
+int64_t FileSystem::clusterIndex(int64_t address) const {
+    int32_t g = this->groupOfAddress(address);
+    const group_descriptor &descriptor = this->groups[g]->descriptor;
+    int64_t offset = address - descriptor.data_start_address;
+    if (offset < 0 || (offset & (this->clusterSize() - 1)) != 0 || (offset >> this->cluster_shift) >= descriptor.cluster_count) {
+        return -1;
+    }
+    return g * this->super_block.clusters_per_group + (offset >> this->cluster_shift);
+}
+
+bool FileSystem::isClusterUsed(int64_t index) const {
+    Group &group = *this->groups[index / this->super_block.clusters_per_group];
+    int64_t local = index % this->super_block.clusters_per_group;
+    std::lock_guard<std::mutex> lock(group.mutex);
+    return local < (int64_t) group.clusterBitmap.size() && group.clusterBitmap[local];
+}
+
+int64_t FileSystem::indexAddress(int64_t index) const {
+    const Group &group = *this->groups[index / this->super_block.clusters_per_group];
+    return group.descriptor.data_start_address + ((index % this->super_block.clusters_per_group) << this->cluster_shift);
+}
+
+void FileSystem::rebuildBitmaps(const std::vector<bool>& inodes, const std::vector<bool>& clusters) {
+    for (const auto &group : this->groups) {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        group_descriptor &descriptor = group->descriptor;
+        int64_t firstInode = (int64_t) group->index * this->super_block.inodes_per_group;
+        int64_t firstCluster = group->index * this->super_block.clusters_per_group;
+
+        descriptor.free_inodes = 0;
+        for (int64_t i = 0; i < descriptor.inode_count; ++i) {
+            group->inodeBitmap[i] = inodes[firstInode + i];
+            descriptor.free_inodes += group->inodeBitmap[i] ? 0 : 1;
+        }
+        descriptor.free_clusters = 0;
+        for (int64_t i = 0; i < descriptor.cluster_count; ++i) {
+            group->clusterBitmap[i] = clusters[firstCluster + i];
+            descriptor.free_clusters += group->clusterBitmap[i] ? 0 : 1;
+        }
+
+        this->writeBits(group->inodeBitmap, 0, descriptor.inode_count, descriptor.bitmapi_start_address);
+        if (descriptor.cluster_count > 0) {
+            this->writeBits(group->clusterBitmap, 0, descriptor.cluster_count, descriptor.bitmap_start_address);
+        }
+        this->saveGroup(*group);
+    }
+    this->recount();
+    this->saveSuperblock();
+}
+
+void FileSystem::read(void* buffer, size_t size, int64_t address) {
+    this->transfer((char *) buffer, size, address, false);
+}
+
+void FileSystem::write(void *buffer, size_t size, int64_t address) {
+    // marked before and after - a sync in between never sees the write as finished
+    bool checksums = this->checksums();
+    if (checksums) {
+        this->markDirty(address, size);
+    }
+    this->transfer((char *) buffer, size, address, true);
+    if (checksums) {
+        this->markDirty(address, size);
+    }
+}
+
+int64_t FileSystem::memberSize(size_t member, int64_t byteSize) const {
+    // whole rows of stripes plus this member's share of the last one
+    int64_t row = (int64_t) this->stripe_unit * (int64_t) this->members.size();
+    int64_t rest = byteSize % row - (int64_t) member * this->stripe_unit;
+    rest = rest < 0 ? 0 : (rest > this->stripe_unit ? this->stripe_unit : rest);
+    return byteSize / row * this->stripe_unit + rest;
+}
+
+std::vector<FileSystem::Piece> FileSystem::mapRange(char* buffer, size_t size, int64_t address) const {
+    // stripe s lives in member s % count at offset (s / count) * unit
+    std::vector<Piece> pieces;
+    size_t count = this->members.size();
+    if (count == 1) {
+        pieces.push_back(Piece{0, address, buffer, size});
+        return pieces;
+    }
+    while (size > 0) {
+        int64_t stripe = address / this->stripe_unit;
+        int64_t rest = address % this->stripe_unit;
+        size_t chunk = (size_t) std::min<int64_t>((int64_t) size, this->stripe_unit - rest);
+        pieces.push_back(Piece{(size_t) (stripe % (int64_t) count), stripe / (int64_t) count * this->stripe_unit + rest, buffer, chunk});
+        buffer += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+    return pieces;
+}
+
+void FileSystem::transfer(char* buffer, size_t size, int64_t address, bool write) {
+    std::vector<Piece> pieces = this->mapRange(buffer, size, address);
+    for (const Piece &piece : pieces) {
+        this->getFile(piece.member);
+    }
+    if (pieces.size() == 1 || (int64_t) size < STRIPE_PARALLEL_SIZE) {
+        for (const Piece &piece : pieces) {
+            transferPiece(this->openedFiles[piece.member], piece, write);
+        }
+        return;
+    }
+
+    // large requests go to all members at once, each member's pieces in order
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t left = this->members.size() - 1;
+    for (size_t member = 1; member < this->members.size(); ++member) {
+        this->ioPool->submit([this, &pieces, &mutex, &finished, &left, member, write] {
+            for (const Piece &piece : pieces) {
+                if (piece.member == member) {
+                    transferPiece(this->openedFiles[member], piece, write);
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--left == 0) {
+                finished.notify_one();
+            }
+        });
+    }
+    for (const Piece &piece : pieces) {
+        if (piece.member == 0) {
+            transferPiece(this->openedFiles[0], piece, write);
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [&left] { return left == 0; });
+}
+
+void FileSystem::transferPiece(int file, const Piece& piece, bool write) {
+    char *buffer = piece.buffer;
+    int64_t offset = piece.offset;
+    size_t size = piece.size;
+    while (size > 0) {
+        ssize_t done = write ? pwrite(file, buffer, size, offset) : pread(file, buffer, size, offset);
+        if (done <= 0) {
+            if (!write) {
+                // past the end of the file - reads as zeros
+                memset(buffer, 0, size);
+            }
+            return;
+        }
+        buffer += done;
+        offset += done;
+        size -= done;
+    }
 }
 
 void FileSystem::saveInode(const pseudo_inode* inode) {
-    int32_t address = this->super_block.inode_start_address + (inode->node_id * sizeof(pseudo_inode));
-    this->write((void *) inode, sizeof(pseudo_inode), address);
+    const Group &group = *this->groups[inode->node_id / this->super_block.inodes_per_group];
+    int64_t local = inode->node_id % this->super_block.inodes_per_group;
+    int64_t address = group.descriptor.inode_start_address + (local * this->inodeRecordSize());
+    if (this->super_block.version == 1) {
+        pseudo_inode_v1 old{};
+        inodeToV1(inode, old);
+        this->write((void *) &old, INODE_SIZE_V1, address);
+        return;
+    }
+    this->write((void *) inode, INODE_SIZE, address);
+}
+
+int64_t FileSystem::readLink(int64_t address) {
+    if (this->linkSize() == sizeof(int32_t)) {
+        int32_t link;
+        this->read(&link, sizeof(int32_t), address);
+        return link;
+    }
+    int64_t link;
+    this->read(&link, sizeof(int64_t), address);
+    return link;
+}
+
+void FileSystem::writeLink(int64_t address, int64_t link) {
+    if (this->linkSize() == sizeof(int32_t)) {
+        auto shortLink = (int32_t) link;
+        this->write(&shortLink, sizeof(int32_t), address);
+        return;
+    }
+    this->write(&link, sizeof(int64_t), address);
+}
+
+std::vector<int64_t> FileSystem::readLinks(int64_t address) {
+    std::vector<int64_t> links(this->linksPerCluster());
+    if (this->linkSize() == sizeof(int32_t)) {
+        std::vector<int32_t> shortLinks(links.size());
+        this->read(shortLinks.data(), this->clusterSize(), address);
+        for (size_t i = 0; i < links.size(); ++i) {
+            links[i] = shortLinks[i];
+        }
+        return links;
+    }
+    this->read(links.data(), this->clusterSize(), address);
+    return links;
+}
+
+void FileSystem::writeLinks(int64_t address, const std::vector<int64_t>& links) {
+    if (this->linkSize() == sizeof(int32_t)) {
+        std::vector<int32_t> shortLinks(this->linksPerCluster(), 0);
+        for (size_t i = 0; i < links.size() && i < shortLinks.size(); ++i) {
+            shortLinks[i] = (int32_t) links[i];
+        }
+        this->write(shortLinks.data(), this->clusterSize(), address);
+        return;
+    }
+    std::vector<int64_t> fullLinks(links);
+    fullLinks.resize(this->linksPerCluster(), 0);
+    this->write(fullLinks.data(), this->clusterSize(), address);
+}
+
+int32_t FileSystem::linkSize() const {
+    return this->super_block.version == 1 ? sizeof(int32_t) : sizeof(int64_t);
+}
+
+int64_t FileSystem::linksPerCluster() const {
+    return this->clusterSize() / this->linkSize();
+}
+
+int32_t FileSystem::indirectLevels() const {
+    return this->super_block.version == 1 ? 2 : 3;
+}
+
+int32_t FileSystem::inlineDataSize() const {
+    return this->super_block.version == 1 ? INLINE_DATA_SIZE_V1 : INLINE_DATA_SIZE;
+}
+
+int64_t FileSystem::maxFileSize() const {
+    int64_t clusters = 5;
+    int64_t levelClusters = 1;
+    for (int32_t level = 0; level < this->indirectLevels(); ++level) {
+        levelClusters *= this->linksPerCluster();
+        clusters += levelClusters;
+    }
+    int64_t size = clusters * this->clusterSize();
+    if (this->super_block.version == 1 && size > INT32_MAX) {
+        return INT32_MAX;
+    }
+    return size;
+}
+
+int32_t FileSystem::clusterSize() const {
+    return this->super_block.cluster_size;
+}
+
+int32_t FileSystem::clusterShift() const {
+    return this->cluster_shift;
+}
+
+void FileSystem::updateClusterGeometry() {
+    this->cluster_shift = 0;
+    while ((1 << this->cluster_shift) < this->super_block.cluster_size) {
+        this->cluster_shift++;
+    }
 }
 
-FILE *FileSystem::getFile() {
-    if (fileCounter <= 0) {
-        openedFile = fopen(this->realFile.c_str(), "r+b");
+int32_t FileSystem::inodeRecordSize() const {
+    return this->super_block.version == 1 ? INODE_SIZE_V1 : INODE_SIZE;
+}
+
+int FileSystem::getFile(size_t member) {
+    if (this->openedFiles[member] < 0) {
+        this->openedFiles[member] = open(this->members[member].c_str(), O_RDWR);
     }
-    fileCounter++;
-    return openedFile;
+    return this->openedFiles[member];
 }
 
 void FileSystem::releaseFile() {
-    fileCounter--;
-    if (fileCounter < 0) {
-        fileCounter = 0;
+    for (int &file : this->openedFiles) {
+        if (file >= 0) {
+            close(file);
+            file = -1;
+        }
     }
-    if (fileCounter == 0 && openedFile != nullptr) {
-        fclose(openedFile);
-        openedFile = nullptr;
+}
+
+void FileSystem::saveInodes(std::vector<const pseudo_inode*> inodes) {
+    // consecutive records of one group are written at once
+    std::sort(inodes.begin(), inodes.end(), [](const pseudo_inode* a, const pseudo_inode* b) {
+        return a->node_id < b->node_id;
+    });
+    int32_t recordSize = this->inodeRecordSize();
+    std::vector<char> buffer;
+    size_t i = 0;
+    while (i < inodes.size()) {
+        size_t run = 1;
+        while (i + run < inodes.size() && inodes[i + run]->node_id == inodes[i]->node_id + (int32_t) run
+               && inodes[i + run]->node_id % this->super_block.inodes_per_group != 0) {
+            run++;
+        }
+        buffer.assign(run * recordSize, 0);
+        for (size_t j = 0; j < run; ++j) {
+            if (this->super_block.version == 1) {
+                pseudo_inode_v1 old{};
+                inodeToV1(inodes[i + j], old);
+                memcpy(buffer.data() + j * recordSize, &old, INODE_SIZE_V1);
+            } else {
+                memcpy(buffer.data() + j * recordSize, inodes[i + j], INODE_SIZE);
+            }
+        }
+        const Group &group = *this->groups[inodes[i]->node_id / this->super_block.inodes_per_group];
+        int64_t local = inodes[i]->node_id % this->super_block.inodes_per_group;
+        this->write(buffer.data(), buffer.size(), group.descriptor.inode_start_address + local * recordSize);
+        i += run;
     }
 }
 
-void FileSystem::setBit(int32_t bit, bool state, int32_t address) {
+void FileSystem::setBit(int64_t bit, bool state, int64_t address) {
     address += bit / 8;
     char byteState;
     this->read(&byteState, 1, address);
@@ -215,16 +1135,298 @@ void FileSystem::setBit(int32_t bit, bool state, int32_t address) {
     this->write(&byteState, 1, address);
 }
 
-void FileSystem::removeClusterByAddress(int32_t address) {
-    address -= this->super_block.data_start_address;
-    address /= CLUSTER_SIZE;
+void FileSystem::removeClusterByAddress(int64_t address) {
+    Group &group = *this->groups[this->groupOfAddress(address)];
+    int64_t local = (address - group.descriptor.data_start_address) >> this->cluster_shift;
+
+    {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        if (!group.clusterBitmap[local]) {
+            return;
+        }
+        group.clusterBitmap[local] = false;
+        group.descriptor.free_clusters++;
+        this->account(0, -1);
+        this->setBit(local, false, group.descriptor.bitmap_start_address);
+        this->saveGroup(group);
+    }
+
+    // freed clusters are given back to the host in batches
+    if (this->discard()) {
+        std::unique_lock<std::mutex> lock(this->discardMutex);
+        this->discarded.push_back(address);
+        if (this->discarded.size() >= DISCARD_BATCH) {
+            lock.unlock();
+            this->discardPending();
+        }
+    }
+}
+
+bool FileSystem::discard() const {
+    return (this->super_block.features & FEATURE_DISCARD) != 0;
+}
+
+bool FileSystem::setDiscard(bool enabled) {
+    // the flag lives in the superblock - v1 images have no room for it
+    if (this->super_block.version == 1) {
+        return false;
+    }
+    if (!enabled) {
+        this->discardPending();
+    }
+    {
+        std::lock_guard<std::mutex> lock(this->counterMutex);
+        this->super_block.features = enabled ? (this->super_block.features | FEATURE_DISCARD) : (this->super_block.features & ~FEATURE_DISCARD);
+    }
+    this->saveSuperblock();
+    return true;
+}
+
+void FileSystem::discardPending() {
+    std::vector<int64_t> addresses;
+    {
+        std::lock_guard<std::mutex> lock(this->discardMutex);
+        addresses.swap(this->discarded);
+    }
+    std::sort(addresses.begin(), addresses.end());
+
+    // neighbouring clusters that are still free become one hole, the group lock keeps them free meanwhile
+    int64_t clusterSize = this->clusterSize();
+    size_t i = 0;
+    while (i < addresses.size()) {
+        Group &group = *this->groups[this->groupOfAddress(addresses[i])];
+        int64_t end = group.descriptor.data_start_address + (group.descriptor.cluster_count << this->cluster_shift);
+        std::lock_guard<std::mutex> lock(group.mutex);
+        int64_t start = -1;
+        int64_t length = 0;
+        for (; i < addresses.size() && addresses[i] < end; ++i) {
+            int64_t local = (addresses[i] - group.descriptor.data_start_address) >> this->cluster_shift;
+            if (group.clusterBitmap[local]) {
+                continue;
+            }
+            if (start != -1 && start + length == addresses[i]) {
+                length += clusterSize;
+                continue;
+            }
+            if (start != -1) {
+                this->punchRange(start, length);
+            }
+            start = addresses[i];
+            length = clusterSize;
+        }
+        if (start != -1) {
+            this->punchRange(start, length);
+        }
+    }
+}
+
+int64_t FileSystem::trim() {
+    // every free run of every group, -1 when the host cannot punch holes
+    {
+        std::lock_guard<std::mutex> lock(this->discardMutex);
+        this->discarded.clear();
+    }
+    int64_t trimmed = 0;
+    for (const auto &group : this->groups) {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        const group_descriptor &descriptor = group->descriptor;
+        int64_t i = 0;
+        while (i < descriptor.cluster_count) {
+            if (group->clusterBitmap[i]) {
+                i++;
+                continue;
+            }
+            int64_t run = 1;
+            while (i + run < descriptor.cluster_count && !group->clusterBitmap[i + run]) {
+                run++;
+            }
+            if (!this->punchRange(descriptor.data_start_address + (i << this->cluster_shift), run << this->cluster_shift)) {
+                return -1;
+            }
+            trimmed += run;
+            i += run;
+        }
+    }
+    return trimmed;
+}
 
-    this->clusterBitmap[address] = false;
-    this->setBit(address, false, this->super_block.bitmap_start_address);
-//    std::cout << "REMOVING CLUSTER - " << address << std::endl;
+bool FileSystem::punchRange(int64_t address, int64_t length) {
+    // the range may be spread over several member files
+    for (const Piece &piece : this->mapRange(nullptr, (size_t) length, address)) {
+        if (fallocate(this->getFile(piece.member), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, piece.offset, (off_t) piece.size) != 0) {
+            return false;
+        }
+    }
+    return true;
 }
 
 void FileSystem::removeInode(std::shared_ptr<pseudo_inode> inode) {
-    this->inodeBitmap[inode->node_id] = false;
-    this->setBit(inode->node_id, false, this->super_block.bitmapi_start_address);
+    Group &group = *this->groups[inode->node_id / this->super_block.inodes_per_group];
+    int32_t local = inode->node_id % this->super_block.inodes_per_group;
+
+    std::lock_guard<std::mutex> lock(group.mutex);
+    if (!group.inodeBitmap[local]) {
+        return;
+    }
+    group.inodeBitmap[local] = false;
+    group.descriptor.free_inodes++;
+    this->account(-1, 0);
+    this->setBit(local, false, group.descriptor.bitmapi_start_address);
+    this->saveGroup(group);
+}
+
+int32_t FileSystem::groupOfAddress(int64_t address) const {
+    if (this->groups.size() == 1) {
+        return 0;
+    }
+    int64_t group = (address - this->super_block.first_group_address) / this->super_block.group_size;
+    if (group < 0) {
+        return 0;
+    }
+    return group >= (int64_t) this->groups.size() ? (int32_t) this->groups.size() - 1 : (int32_t) group;
+}
+
+void FileSystem::writeBits(const std::vector<bool>& bitmap, int64_t from, int64_t count, int64_t address) {
+    // rewrite whole bytes covering bits [from, from + count)
+    int64_t firstByte = from / 8;
+    int64_t lastByte = (from + count - 1) / 8;
+    std::vector<unsigned char> bytes(lastByte - firstByte + 1, 0);
+    for (int64_t i = firstByte * 8; i < (lastByte + 1) * 8 && i < (int64_t) bitmap.size(); ++i) {
+        if (bitmap[i]) {
+            bytes[i / 8 - firstByte] |= (unsigned char) (1 << (7 - (i % 8)));
+        }
+    }
+    this->write(bytes.data(), bytes.size(), address + firstByte);
+}
+
+void FileSystem::account(int64_t inodes, int64_t clusters) {
+    // inodes and clusters taken (positive) or released (negative)
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    this->super_block.free_inodes -= (int32_t) inodes;
+    this->super_block.used_inodes += (int32_t) inodes;
+    this->super_block.free_clusters -= clusters;
+    this->super_block.used_clusters += clusters;
+}
+
+void FileSystem::recount() {
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    this->super_block.free_inodes = 0;
+    this->super_block.free_clusters = 0;
+    for (const auto &group : this->groups) {
+        this->super_block.free_inodes += group->descriptor.free_inodes;
+        this->super_block.free_clusters += group->descriptor.free_clusters;
+    }
+    this->super_block.used_inodes = this->super_block.inode_count - this->super_block.free_inodes;
+    this->super_block.used_clusters = this->super_block.cluster_count - this->super_block.free_clusters;
+}
+
+void FileSystem::saveSuperblock() {
+    if (this->super_block.version == 1) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(this->counterMutex);
+    this->write(&this->super_block, SUPERBLOCK_SIZE, 0);
+}
+
+bool FileSystem::checksums() const {
+    return (this->super_block.features & FEATURE_CHECKSUMS) != 0;
+}
+
+int64_t FileSystem::checksumAddress(const Group& group) const {
+    // checksum region follows the inode table of the group
+    return group.descriptor.inode_start_address + (int64_t) group.descriptor.inode_count * INODE_SIZE;
+}
+
+void FileSystem::markDirty(int64_t address, size_t size) {
+    // clusters written since the last sync with a count of marks - their checksums are recomputed later
+    int64_t end = address + (int64_t) size;
+    while (address < end) {
+        Group &group = *this->groups[this->groupOfAddress(address)];
+        int64_t dataEnd = group.descriptor.data_start_address + (group.descriptor.cluster_count << this->cluster_shift);
+        if (address < group.descriptor.data_start_address || address >= dataEnd) {
+            return;
+        }
+        int64_t first = (address - group.descriptor.data_start_address) >> this->cluster_shift;
+        int64_t stop = std::min(end, dataEnd);
+        int64_t last = (stop - 1 - group.descriptor.data_start_address) >> this->cluster_shift;
+        {
+            std::lock_guard<std::mutex> lock(this->checksumMutex);
+            for (int64_t i = first; i <= last; ++i) {
+                group.dirty[i]++;
+            }
+        }
+        address = stop;
+    }
+}
+
+void FileSystem::syncChecksums() {
+    if (!this->checksums()) {
+        return;
+    }
+    // one sync at a time - a later sync must not be overtaken by an earlier one
+    std::lock_guard<std::mutex> syncLock(this->syncMutex);
+    std::vector<char> buffer(this->clusterSize());
+    for (const auto &group : this->groups) {
+        std::map<int64_t, int64_t> dirty;
+        {
+            std::lock_guard<std::mutex> lock(this->checksumMutex);
+            dirty = group->dirty;
+        }
+        // consecutive checksums are written at once
+        std::vector<uint32_t> run;
+        int64_t runStart = -1;
+        for (auto it = dirty.begin(); it != dirty.end(); ++it) {
+            this->read(buffer.data(), buffer.size(), group->descriptor.data_start_address + (it->first << this->cluster_shift));
+            uint32_t checksum = Crc32c::compute(buffer.data(), buffer.size());
+            {
+                // a cluster marked again since the copy stays dirty until the next sync
+                std::lock_guard<std::mutex> lock(this->checksumMutex);
+                group->checksums[it->first] = checksum;
+                auto current = group->dirty.find(it->first);
+                if (current != group->dirty.end() && current->second == it->second) {
+                    group->dirty.erase(current);
+                }
+            }
+            if (runStart == -1) {
+                runStart = it->first;
+            }
+            run.push_back(checksum);
+            auto next = std::next(it);
+            if (next == dirty.end() || next->first != it->first + 1) {
+                this->write(run.data(), run.size() * CHECKSUM_SIZE, this->checksumAddress(*group) + runStart * CHECKSUM_SIZE);
+                run.clear();
+                runStart = -1;
+            }
+        }
+    }
+}
+
+bool FileSystem::isClusterDirty(int64_t address) {
+    const Group &group = *this->groups[this->groupOfAddress(address)];
+    int64_t local = (address - group.descriptor.data_start_address) >> this->cluster_shift;
+    std::lock_guard<std::mutex> lock(this->checksumMutex);
+    return group.dirty.count(local) != 0;
+}
+
+bool FileSystem::verifyCluster(int64_t address, const void* data) {
+    // dirty clusters have no valid checksum yet
+    if (!this->checksums()) {
+        return true;
+    }
+    const Group &group = *this->groups[this->groupOfAddress(address)];
+    int64_t local = (address - group.descriptor.data_start_address) >> this->cluster_shift;
+    if (local < 0 || local >= group.descriptor.cluster_count) {
+        return true;
+    }
+    uint32_t checksum = Crc32c::compute(data, this->clusterSize());
+    std::lock_guard<std::mutex> lock(this->checksumMutex);
+    return group.dirty.count(local) != 0 || group.checksums[local] == checksum;
+}
+
+void FileSystem::saveGroup(const Group& group) {
+    if (this->super_block.version == 1) {
+        return;
+    }
+    int64_t address = this->super_block.group_table_address + group.index * (int64_t) sizeof(group_descriptor);
+    this->write((void *) &group.descriptor, sizeof(group_descriptor), address);
 }
@@ -1,38 +1,136 @@
 #pragma once
 
 #include <string>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include "INode.hpp"
+#include "ThreadPool.hpp"
+#include "consts.hpp"
 
 class FileSystem : public std::enable_shared_from_this<FileSystem> {
 public:
     explicit FileSystem(std::string realFile);
+    ~FileSystem();
 
-    int format(unsigned long byteSize);
+    int format(uint64_t byteSize, int32_t clusterSize = CLUSTER_SIZE, int32_t stripeUnit = STRIPE_UNIT);
+    int grow(uint64_t byteSize);
 
-    std::shared_ptr<INode> createInode();
+    std::shared_ptr<INode> createInode(int32_t parent = -1);
+    std::vector<std::shared_ptr<INode>> createInodes(int32_t count, int32_t parent = -1);
     std::shared_ptr<INode> getInode(int index);
-    int32_t createCluster();
+    bool readInode(int index, pseudo_inode& inode);
+    std::vector<std::shared_ptr<INode>> getInodes(const std::vector<int32_t>& ids);
+    int64_t createCluster(int64_t goal = -1);
+    int64_t inodeGoal(int32_t nodeId) const;
+    int64_t findFreeRun(int64_t count, int64_t goal = -1);
+    bool allocateRun(int64_t address, int64_t count);
+    int64_t largestFreeRun();
+    int64_t freeClusters();
+    int64_t freeInodes();
+    int64_t usedClusters();
+    int64_t usedInodes();
+    int64_t clusterCount() const;
+    int64_t linkClusterCount(int64_t dataClusters) const;
+    int64_t fileClusterCount(int64_t size) const;
 
-    void load();
-    void read(void* buffer, size_t size, int32_t address);
-    void write(void* buffer, size_t size, int32_t address);
-    void removeClusterByAddress(int32_t address);
+    int32_t inodeCount() const;
+    int32_t inodesPerGroup() const;
+    bool isInodeUsed(int32_t nodeId) const;
+    std::vector<pseudo_inode> readInodes(int32_t first, int32_t count);
+    int64_t clusterIndexCount() const;
+    int64_t clusterIndex(int64_t address) const;
+    int64_t indexAddress(int64_t index) const;
+    bool isClusterUsed(int64_t index) const;
+    void rebuildBitmaps(const std::vector<bool>& inodes, const std::vector<bool>& clusters);
+    std::vector<int64_t> groupTableClusters() const;
+
+    int load();
+    bool exists() const;
+    void create(int64_t byteSize);
+    int64_t imageSize();
+    int32_t stripeUnit() const;
+    int32_t stripeCount() const;
+    std::vector<std::pair<int64_t, int64_t>> usedExtents();
+    void read(void* buffer, size_t size, int64_t address);
+    void write(void* buffer, size_t size, int64_t address);
+    void removeClusterByAddress(int64_t address);
     void saveInode(const pseudo_inode* inode);
+    void saveInodes(std::vector<const pseudo_inode*> inodes);
     void removeInode(std::shared_ptr<pseudo_inode> inode);
 
+    int64_t readLink(int64_t address);
+    void writeLink(int64_t address, int64_t link);
+    std::vector<int64_t> readLinks(int64_t address);
+    void writeLinks(int64_t address, const std::vector<int64_t>& links);
+    int32_t clusterSize() const;
+    int32_t clusterShift() const;
+    int32_t linkSize() const;
+    int64_t linksPerCluster() const;
+    int32_t indirectLevels() const;
+    int32_t inlineDataSize() const;
+    int64_t maxFileSize() const;
+
+    bool checksums() const;
+    void syncChecksums();
+    bool verifyCluster(int64_t address, const void* data);
+    bool isClusterDirty(int64_t address);
+
+    bool discard() const;
+    bool setDiscard(bool enabled);
+    void discardPending();
+    int64_t trim();
+
 private:
-    std::string realFile;
+    struct Group {
+        int32_t index;
+        group_descriptor descriptor;
+        std::vector<bool> inodeBitmap;
+        std::vector<bool> clusterBitmap;
+        std::vector<uint32_t> checksums;
+        std::map<int64_t, int64_t> dirty;
+        std::mutex mutex;
+    };
+
+    struct Piece {
+        size_t member;
+        int64_t offset;
+        char* buffer;
+        size_t size;
+    };
+
+    std::vector<std::string> members;
+    std::vector<int> openedFiles;
+    int32_t stripe_unit = STRIPE_UNIT;
+    std::unique_ptr<ThreadPool> ioPool;
     superblock super_block;
-    std::vector<bool> inodeBitmap;
-    std::vector<bool> clusterBitmap;
-    FILE* openedFile = nullptr;
-    FILE* getFile();
+    std::vector<std::shared_ptr<Group>> groups;
+    int32_t cluster_shift = 0;
+    std::mutex counterMutex;
+    std::mutex checksumMutex;
+    std::mutex syncMutex;
+    std::vector<int64_t> discarded;
+    std::mutex discardMutex;
+    int getFile(size_t member = 0);
     void releaseFile();
-    int fileCounter = 0;
-    void setBit(int32_t bit, bool state, int32_t address);
+    int64_t memberSize(size_t member, int64_t byteSize) const;
+    void extend(int64_t byteSize);
+    int64_t groupCapacity() const;
+    bool relocateGroupTable();
+    std::vector<Piece> mapRange(char* buffer, size_t size, int64_t address) const;
+    void transfer(char* buffer, size_t size, int64_t address, bool write);
+    static void transferPiece(int file, const Piece& piece, bool write);
+    bool punchRange(int64_t address, int64_t length);
+    void setBit(int64_t bit, bool state, int64_t address);
+    void updateClusterGeometry();
+    int32_t inodeRecordSize() const;
+    int32_t groupOfAddress(int64_t address) const;
+    void saveGroup(const Group& group);
+    int64_t checksumAddress(const Group& group) const;
+    void markDirty(int64_t address, size_t size);
+    void account(int64_t inodes, int64_t clusters);
+    void recount();
+    void saveSuperblock();
+    void writeBits(const std::vector<bool>& bitmap, int64_t from, int64_t count, int64_t address);
 };
-
-
-
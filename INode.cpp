@@ -1,7 +1,76 @@
 
 
 #include "INode.hpp"
+#include <cstring>
 
-void INode::truncate(const std::shared_ptr<FileSystem>& fileSystem, int32_t newSize) {
-    return std::make_shared<MemoryIterator>(this->shared_from_this(), fileSystem, true)->truncate(newSize);
+void INode::truncate(const std::shared_ptr<FileSystem>& fileSystem, int64_t newSize) {
+    return MemoryIterator(*this, *fileSystem, true).truncate(newSize);
+}
+
+void INode::blockMap(const std::shared_ptr<FileSystem>& fileSystem, std::vector<int64_t>& data, std::vector<int64_t>& links) {
+    return MemoryIterator(*this, *fileSystem, false).blockMap(data, links);
+}
+
+void INode::assignClusters(const std::shared_ptr<FileSystem>& fileSystem, const std::vector<int64_t>& data, const std::vector<int64_t>& links) {
+    return MemoryIterator(*this, *fileSystem, false).assignClusters(data, links);
+}
+
+bool INode::relocate(const std::shared_ptr<FileSystem>& fileSystem) {
+    return MemoryIterator(*this, *fileSystem, false).relocate();
+}
+
+int INode::allocate(const std::shared_ptr<FileSystem>& fileSystem, int64_t size) {
+    auto output = this->open(fileSystem);
+    int status = output->allocate(size);
+    output->close();
+    return status;
+}
+
+int INode::copyTo(const std::shared_ptr<FileSystem>& fileSystem, const std::shared_ptr<INode>& target, int64_t start) {
+    // start is a run of fileClusterCount(size) clusters the caller already allocated
+    MemoryIterator input(*this, *fileSystem, false);
+    int64_t size = input.size();
+    if (start != -1 && fileSystem->fileClusterCount(size) > 0) {
+        // clusters of links first, data after them
+        int64_t clusterSize = fileSystem->clusterSize();
+        int64_t count = (size + clusterSize - 1) >> fileSystem->clusterShift();
+        std::vector<int64_t> links(fileSystem->linkClusterCount(count));
+        std::vector<int64_t> data(count);
+        for (size_t i = 0; i < links.size(); ++i) {
+            links[i] = start + (int64_t) i * clusterSize;
+        }
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = start + (int64_t) (links.size() + i) * clusterSize;
+        }
+
+        std::vector<char> buffer(1 << 16);
+        int64_t done = 0;
+        while (done < size) {
+            int64_t chunk = std::min<int64_t>((int64_t) buffer.size(), size - done);
+            int64_t r = input.read(buffer.data(), chunk);
+            memset(buffer.data() + r, 0, (size_t) (chunk - r));
+            fileSystem->write(buffer.data(), (size_t) chunk, data[0] + done);
+            done += chunk;
+        }
+        target->inode->flags = 0;
+        target->inode->file_size = size;
+        target->assignClusters(fileSystem, data, links);
+        fileSystem->saveInode(target->inode.get());
+        fileSystem->syncChecksums();
+        return 0;
+    }
+
+    auto output = target->open(fileSystem);
+    if (output->allocate(size, true) != 0) {
+        // whatever was allocated is released again
+        output->close();
+        return 1;
+    }
+    std::vector<char> buffer(1 << 16);
+    int64_t r;
+    while ((r = input.read(buffer.data(), buffer.size())) > 0) {
+        output->write(buffer.data(), r);
+    }
+    output->close();
+    return 0;
 }
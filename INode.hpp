@@ -4,6 +4,7 @@
 #include <memory>
 #include "structs.hpp"
 #include "MemoryIterator.hpp"
+#include "Pool.hpp"
 #include "FileSystem.hpp"
 
 class INode : public std::enable_shared_from_this<INode> {
@@ -23,6 +24,10 @@ class INode : public std::enable_shared_from_this<INode> {
             return c;
         }
 
+        std::streamsize xsputn(const char* s, std::streamsize n) override {
+            return this->memoryIterator->write(s, n);
+        }
+
         std::shared_ptr<MemoryIterator> memoryIterator;
     };
     class InputStream {
@@ -32,17 +37,21 @@ class INode : public std::enable_shared_from_this<INode> {
         }
 
         int read(void* buffer, size_t size) {
-            for (int i = 0; i < size; ++i) {
-                int c = this->memoryIterator->readc();
-                if (this->memoryIterator->readDone) {
-                    return EOF;
-                }
-                *((char*)buffer + i) = (char) c;
+            if (this->memoryIterator->read((char*) buffer, size) < (int64_t) size) {
+                return EOF;
             }
 
             return 0;
         }
 
+        int64_t readAvailable(void* buffer, size_t size) {
+            return this->memoryIterator->read((char*) buffer, size);
+        }
+
+        bool corrupted() const {
+            return this->memoryIterator->corrupted;
+        }
+
     protected:
         std::shared_ptr<MemoryIterator> memoryIterator;
     };
@@ -53,13 +62,33 @@ public:
     };
 
     OutputStream getOutputStream(const std::shared_ptr<FileSystem>& fileSystem) {
-        return OutputStream(std::make_shared<MemoryIterator>(this->shared_from_this(), fileSystem, true));
+        return OutputStream(makePooled<MemoryIterator>(this->shared_from_this(), fileSystem, true));
+    };
+    OutputStream getAppendStream(const std::shared_ptr<FileSystem>& fileSystem) {
+        auto memoryIterator = makePooled<MemoryIterator>(this->shared_from_this(), fileSystem, true, false);
+        memoryIterator->seekEnd();
+        return OutputStream(memoryIterator);
     };
     InputStream getInputStream(const std::shared_ptr<FileSystem>& fileSystem) {
-        return InputStream(std::make_shared<MemoryIterator>(this->shared_from_this(), fileSystem, false));
+        return InputStream(makePooled<MemoryIterator>(this->shared_from_this(), fileSystem, false));
+    };
+
+    std::shared_ptr<MemoryIterator> open(const std::shared_ptr<FileSystem>& fileSystem) {
+        return makePooled<MemoryIterator>(this->shared_from_this(), fileSystem, true, false);
     };
 
-    void truncate(const std::shared_ptr<FileSystem>& fileSystem, int32_t newSize = 0);
+    void truncate(const std::shared_ptr<FileSystem>& fileSystem, int64_t newSize = 0);
+    int allocate(const std::shared_ptr<FileSystem>& fileSystem, int64_t size);
+    int copyTo(const std::shared_ptr<FileSystem>& fileSystem, const std::shared_ptr<INode>& target, int64_t start = -1);
+    void blockMap(const std::shared_ptr<FileSystem>& fileSystem, std::vector<int64_t>& data, std::vector<int64_t>& links);
+    void assignClusters(const std::shared_ptr<FileSystem>& fileSystem, const std::vector<int64_t>& data, const std::vector<int64_t>& links);
+    bool relocate(const std::shared_ptr<FileSystem>& fileSystem);
+    bool isInline() const {
+        return (this->inode->flags & INODE_FLAG_INLINE) != 0;
+    };
+    char* inlineData() {
+        return reinterpret_cast<char*>(this->inode->direct);
+    };
     std::shared_ptr<pseudo_inode> inode;
 
 };
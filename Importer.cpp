@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "Importer.hpp"
+
+Importer::Importer(std::shared_ptr<FileSystem> fileSystem) {
+    this->fileSystem = std::move(fileSystem);
+}
+
+int Importer::scan(const std::string& hostPath) {
+    struct stat info{};
+    if (stat(hostPath.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+        return 1;
+    }
+    this->entries.clear();
+    this->complete = true;
+    this->entries.push_back(Entry{hostPath, "", true, 0, {}, nullptr});
+    this->scanDirectory(0);
+    return 0;
+}
+
+bool Importer::isComplete() const {
+    return this->complete;
+}
+
+size_t Importer::entryCount() const {
+    return this->entries.size();
+}
+
+int64_t Importer::requiredClusters() const {
+    int64_t required = 0;
+    for (const Entry &entry : this->entries) {
+        int64_t count = this->dataClusters(entry.size);
+        if (count > 0) {
+            required += count + this->fileSystem->linkClusterCount(count);
+        }
+    }
+    return required;
+}
+
+std::shared_ptr<INode> Importer::import(int32_t parent) {
+    // directories are built on this thread, file contents are read by the pool
+    std::vector<std::shared_ptr<INode>> root = this->fileSystem->createInodes(1, parent);
+    if (root.empty()) {
+        return nullptr;
+    }
+    this->entries[0].inode = root[0];
+    this->entries[0].inode->inode->isDirectory = true;
+    this->importDirectory(0, parent);
+    this->pool.wait();
+
+    // metadata of the whole tree is committed at once
+    std::vector<const pseudo_inode*> records;
+    for (const Entry &entry : this->entries) {
+        if (entry.inode != nullptr) {
+            records.push_back(entry.inode->inode.get());
+        }
+    }
+    this->fileSystem->saveInodes(records);
+    return this->entries[0].inode;
+}
+
+void Importer::scanDirectory(size_t index) {
+    DIR *directory = opendir(this->entries[index].hostPath.c_str());
+    if (directory == nullptr) {
+        return;
+    }
+    std::vector<std::string> names;
+    struct dirent *item;
+    while ((item = readdir(directory)) != nullptr) {
+        std::string name = item->d_name;
+        if (name != "." && name != "..") {
+            names.push_back(name);
+        }
+    }
+    closedir(directory);
+    std::sort(names.begin(), names.end());
+
+    // names that fit keep them, longer ones are cut to 8+3 characters with a ~N suffix on collision
+    std::set<std::string> used;
+    for (const std::string &name : names) {
+        if (name.size() <= 11) {
+            used.insert(name);
+        }
+    }
+    for (const std::string &name : names) {
+        std::string hostPath = this->entries[index].hostPath + "/" + name;
+        struct stat info{};
+        if (lstat(hostPath.c_str(), &info) != 0 || (!S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode))) {
+            continue;
+        }
+        std::string shortName = name;
+        if (name.size() > 11) {
+            shortName = name.substr(0, 11);
+            for (int n = 1; used.count(shortName) != 0; ++n) {
+                std::string suffix = "~" + std::to_string(n);
+                shortName = name.substr(0, 11 - suffix.size()) + suffix;
+            }
+            used.insert(shortName);
+        }
+        this->entries[index].children.push_back(this->entries.size());
+        this->entries.push_back(Entry{hostPath, shortName, S_ISDIR(info.st_mode) != 0,
+                                      S_ISDIR(info.st_mode) ? 0 : (int64_t) info.st_size, {}, nullptr});
+        if (S_ISDIR(info.st_mode)) {
+            this->scanDirectory(this->entries.size() - 1);
+        }
+    }
+    this->entries[index].size = (int64_t) ((this->entries[index].children.size() + 2) * sizeof(directory_item));
+}
+
+int64_t Importer::dataClusters(int64_t size) const {
+    if (size <= this->fileSystem->inlineDataSize()) {
+        return 0;
+    }
+    return (size + this->fileSystem->clusterSize() - 1) >> this->fileSystem->clusterShift();
+}
+
+void Importer::importDirectory(size_t index, int32_t parent) {
+    std::shared_ptr<INode> self = this->entries[index].inode;
+    std::vector<size_t> children = this->entries[index].children;
+    std::vector<std::shared_ptr<INode>> inodes = this->fileSystem->createInodes((int32_t) children.size(), self->inode->node_id);
+    if (inodes.size() < children.size()) {
+        // out of inodes - the directory stays empty and the import is reported incomplete
+        for (const std::shared_ptr<INode> &inode : inodes) {
+            this->fileSystem->removeInode(inode->inode);
+        }
+        children.clear();
+        this->complete = false;
+    }
+
+    std::vector<directory_item> items(2);
+    items[0].inode = self->inode->node_id;
+    strcpy(items[0].item_name, ".");
+    items[1].inode = parent;
+    strcpy(items[1].item_name, "..");
+
+    // one run for all files of the directory, each file contiguous in it
+    int64_t total = 0;
+    int8_t subdirectories = 0;
+    for (size_t i = 0; i < children.size(); ++i) {
+        Entry &child = this->entries[children[i]];
+        child.inode = inodes[i];
+        child.inode->inode->isDirectory = child.isDirectory;
+        child.inode->inode->references = 1;
+        if (child.isDirectory) {
+            subdirectories++;
+        } else if (this->dataClusters(child.size) > 0) {
+            int64_t count = this->dataClusters(child.size);
+            total += count + this->fileSystem->linkClusterCount(count);
+        }
+
+        directory_item item{};
+        item.inode = child.inode->inode->node_id;
+        strcpy(item.item_name, child.name.c_str());
+        items.push_back(item);
+    }
+    int64_t goal = this->fileSystem->inodeGoal(self->inode->node_id);
+    int64_t start = total > 0 ? this->fileSystem->findFreeRun(total, goal) : -1;
+    bool batched = start != -1 && this->fileSystem->allocateRun(start, total);
+
+    for (size_t childIndex : children) {
+        const Entry &child = this->entries[childIndex];
+        if (child.isDirectory) {
+            continue;
+        }
+        int64_t run = -1;
+        int64_t count = this->dataClusters(child.size);
+        if (count > 0) {
+            count += this->fileSystem->linkClusterCount(count);
+            if (batched) {
+                run = start;
+                start += count << this->fileSystem->clusterShift();
+            } else {
+                run = this->fileSystem->findFreeRun(count, goal);
+                if (run != -1 && !this->fileSystem->allocateRun(run, count)) {
+                    run = -1;
+                }
+            }
+        }
+        std::shared_ptr<INode> inode = child.inode;
+        std::string hostPath = child.hostPath;
+        int64_t size = child.size;
+        this->pool.submit([this, inode, hostPath, size, run] { this->readFile(inode, hostPath, size, run); });
+    }
+
+    // the directory is written exactly once
+    self->inode->references = (int8_t) (2 + subdirectories);
+    auto output = self->getOutputStream(this->fileSystem);
+    output.sputn(reinterpret_cast<const char *>(items.data()), items.size() * sizeof(directory_item));
+    output.close();
+
+    for (size_t childIndex : children) {
+        if (this->entries[childIndex].isDirectory) {
+            this->importDirectory(childIndex, self->inode->node_id);
+        }
+    }
+}
+
+void Importer::readFile(const std::shared_ptr<INode>& inode, const std::string& hostPath, int64_t size, int64_t start) {
+    FILE *file = fopen(hostPath.c_str(), "rb");
+    std::vector<char> buffer((size_t) std::min<int64_t>(size, 1 << 20));
+    int64_t count = this->dataClusters(size);
+
+    if (count == 0) {
+        // small files live in the inode
+        size_t r = file != nullptr ? fread(inode->inlineData(), 1, size, file) : 0;
+        inode->inode->file_size = (int64_t) r;
+    } else if (start == -1) {
+        // no contiguous run left - write through the iterator
+        auto output = inode->open(this->fileSystem);
+        size_t r;
+        int64_t done = 0;
+        while (file != nullptr && done < size && (r = fread(buffer.data(), 1, std::min<int64_t>(buffer.size(), size - done), file)) > 0) {
+            output->write(buffer.data(), r);
+            done += r;
+        }
+        output->close();
+    } else {
+        // clusters of links first, data after them
+        int64_t clusterSize = this->fileSystem->clusterSize();
+        std::vector<int64_t> links(this->fileSystem->linkClusterCount(count));
+        std::vector<int64_t> data(count);
+        for (size_t i = 0; i < links.size(); ++i) {
+            links[i] = start + (int64_t) i * clusterSize;
+        }
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = start + (int64_t) (links.size() + i) * clusterSize;
+        }
+
+        int64_t done = 0;
+        while (done < size) {
+            size_t chunk = (size_t) std::min<int64_t>(buffer.size(), size - done);
+            size_t r = file != nullptr ? fread(buffer.data(), 1, chunk, file) : 0;
+            memset(buffer.data() + r, 0, chunk - r);
+            this->fileSystem->write(buffer.data(), chunk, data[0] + done);
+            done += chunk;
+        }
+        inode->inode->flags = 0;
+        inode->inode->file_size = size;
+        inode->assignClusters(this->fileSystem, data, links);
+    }
+
+    if (file != nullptr) {
+        fclose(file);
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "FileSystem.hpp"
+#include "ThreadPool.hpp"
+
+class Importer {
+public:
+    explicit Importer(std::shared_ptr<FileSystem> fileSystem);
+
+    int scan(const std::string& hostPath);
+    bool isComplete() const;
+    size_t entryCount() const;
+    int64_t requiredClusters() const;
+    std::shared_ptr<INode> import(int32_t parent);
+
+protected:
+    struct Entry {
+        std::string hostPath;
+        std::string name;
+        bool isDirectory;
+        int64_t size;
+        std::vector<size_t> children;
+        std::shared_ptr<INode> inode;
+    };
+
+    std::shared_ptr<FileSystem> fileSystem;
+    ThreadPool pool;
+    std::vector<Entry> entries;
+    bool complete = true;
+
+    void scanDirectory(size_t index);
+    int64_t dataClusters(int64_t size) const;
+    void importDirectory(size_t index, int32_t parent);
+    void readFile(const std::shared_ptr<INode>& inode, const std::string& hostPath, int64_t size, int64_t start);
+};
@@ -1,51 +1,244 @@
 #include "MemoryIterator.hpp"
 #include "FileSystem.hpp"
 #include "INode.hpp"
+#include <algorithm>
+#include <cstring>
 
-MemoryIterator::MemoryIterator(std::shared_ptr <INode> inode, std::shared_ptr<FileSystem> fileSystem, bool write = false) {
-    this->inode = std::move(inode);
-    this->fileSystem = std::move(fileSystem);
-    this->write = write;
-    if (write) {
-        this->new_size = 0;
-    }
+MemoryIterator::MemoryIterator(std::shared_ptr <INode> inode, std::shared_ptr<FileSystem> fileSystem, bool write, bool overwrite)
+    : MemoryIterator(*inode, *fileSystem, write, overwrite) {
+    this->inodeOwner = std::move(inode);
+    this->fileSystemOwner = std::move(fileSystem);
+}
+
+MemoryIterator::MemoryIterator(INode& inode, FileSystem& fileSystem, bool write, bool overwrite) {
+    this->inode = &inode;
+    this->fileSystem = &fileSystem;
+    this->writable = write;
+    this->new_size = write && overwrite ? 0 : this->inode->inode->file_size;
 
-    this->used_clusters = (this->inode->inode->file_size - 1) / CLUSTER_SIZE;
-    if (this->inode->inode->file_size <= 0) {
+    this->used_clusters = (this->inode->inode->file_size - 1) >> this->fileSystem->clusterShift();
+    if (this->inode->inode->file_size <= 0 || this->inode->isInline()) {
         this->used_clusters = -1;
     }
 
+    this->cluster_shift = this->fileSystem->clusterShift();
+    this->cluster_mask = this->fileSystem->clusterSize() - 1;
+    this->goal = this->fileSystem->inodeGoal(this->inode->inode->node_id);
+
     this->rewind();
 }
 
 
 void MemoryIterator::writec(char c) {
-    int32_t address = this->address();
-    this->fileSystem->write(&c, sizeof(char), address);
-    this->next();
+    this->write(&c, 1);
 }
 
 int MemoryIterator::readc() {
-    if (this->index >= this->inode->inode->file_size) {
+    char c;
+    if (this->read(&c, 1) < 1) {
         readDone = true;
         return EOF;
     }
-    int32_t address = this->address();
-    char c;
-    this->fileSystem->read(&c, sizeof(char), address);
-    this->next();
     return c;
 }
 
-void MemoryIterator::close() {
-    if (this->write) {
-        if (this->new_size < this->inode->inode->file_size) {
-            this->truncate(new_size);
+int MemoryIterator::close() {
+    // 1 when buffered data found no free cluster
+    if (this->writable) {
+        if (!this->inode->isInline() && this->new_size <= this->fileSystem->inlineDataSize()) {
+            this->demoteInline();
+        } else {
+            // release buffered data past the end and clusters preallocated beyond it
+            this->allocatePending();
+            if (this->used_clusters >= 0 && ((this->new_size + this->cluster_mask) >> this->cluster_shift) <= this->used_clusters) {
+                this->inode->inode->file_size = this->allocatedEnd();
+                this->truncate(new_size);
+            }
         }
         this->inode->inode->file_size = new_size;
         this->fileSystem->saveInode(this->inode->inode.get());
-        // TODO truncate overflow
+        this->fileSystem->syncChecksums();
+    }
+    return this->noSpace ? 1 : 0;
+}
+
+int64_t MemoryIterator::read(char* buffer, int64_t size) {
+    int64_t left = this->size() - this->index;
+    if (size > left) {
+        size = left > 0 ? left : 0;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+    if (this->inode->isInline()) {
+        memcpy(buffer, this->inode->inlineData() + this->index, (size_t) size);
+        this->index += size;
+        return size;
+    }
+
+    int64_t done = 0;
+    while (done < size) {
+        int64_t rest = this->index & this->cluster_mask;
+        int64_t chunk = this->cluster_mask + 1 - rest;
+        chunk = chunk < size - done ? chunk : size - done;
+        int64_t cluster = this->index >> this->cluster_shift;
+        if (cluster > this->used_clusters) {
+            // not allocated yet - the data is still in the buffer
+            int64_t offset = this->index - this->allocatedEnd();
+            int64_t buffered = (int64_t) this->pending.size() - offset;
+            buffered = buffered < 0 ? 0 : (buffered < chunk ? buffered : chunk);
+            memcpy(buffer + done, this->pending.data() + offset, (size_t) buffered);
+            memset(buffer + done + buffered, 0, (size_t) (chunk - buffered));
+        } else if (rest == 0 && size - done > this->cluster_mask + 1) {
+            // whole clusters stored one after another are read at once
+            int64_t address = this->clusterAddress(cluster);
+            int64_t limit = std::min((size - done) >> this->cluster_shift, this->used_clusters + 1 - cluster);
+            int64_t count = 1;
+            while (count < limit && this->clusterAddress(cluster + count) == address + (count << this->cluster_shift)) {
+                count++;
+            }
+            chunk = count << this->cluster_shift;
+            this->fileSystem->read(buffer + done, (size_t) chunk, address);
+            for (int64_t i = 0; this->fileSystem->checksums() && i < count; ++i) {
+                int64_t offset = i << this->cluster_shift;
+                if (cluster + i != this->verified_cluster && !this->fileSystem->verifyCluster(address + offset, buffer + done + offset)) {
+                    this->corrupted = true;
+                    this->index += offset;
+                    return done + offset;
+                }
+                this->verified_cluster = cluster + i;
+            }
+        } else if (this->fileSystem->checksums() && cluster != this->verified_cluster) {
+            // whole cluster is read once to check it
+            int64_t address = this->clusterAddress(cluster);
+            char *target = buffer + done;
+            if (chunk <= this->cluster_mask) {
+                this->scratch.resize(this->cluster_mask + 1);
+                target = this->scratch.data();
+            }
+            this->fileSystem->read(target, this->cluster_mask + 1, address);
+            if (!this->fileSystem->verifyCluster(address, target)) {
+                this->corrupted = true;
+                return done;
+            }
+            if (target != buffer + done) {
+                memcpy(buffer + done, target + rest, (size_t) chunk);
+            }
+            this->verified_cluster = cluster;
+        } else {
+            this->fileSystem->read(buffer + done, chunk, this->clusterAddress(cluster) + rest);
+        }
+        this->index += chunk;
+        done += chunk;
     }
+    return done;
+}
+
+int64_t MemoryIterator::write(const char* buffer, int64_t size) {
+    int64_t max = this->fileSystem->maxFileSize();
+    if (this->index > max) {
+        return 0;
+    }
+    if (this->index > this->new_size) {
+        // writing past the end - the gap reads as zeros
+        int64_t position = this->index;
+        std::vector<char> zeros(this->cluster_mask + 1, '\0');
+        this->index = this->new_size;
+        while (this->index < position) {
+            int64_t chunk = position - this->index < (int64_t) zeros.size() ? position - this->index : (int64_t) zeros.size();
+            if (this->write(zeros.data(), chunk) == 0) {
+                return 0;
+            }
+        }
+    }
+    if (this->index + size > max) {
+        size = this->index < max ? max - this->index : 0;
+    }
+
+    int64_t done = 0;
+    if (this->inode->isInline() && size > 0) {
+        if (this->index + size <= this->fileSystem->inlineDataSize()) {
+            memcpy(this->inode->inlineData() + this->index, buffer, size);
+            done = size;
+            this->index += size;
+        } else {
+            this->promoteInline();
+        }
+    }
+    while (done < size) {
+        int64_t rest = this->index & this->cluster_mask;
+        int64_t chunk = this->cluster_mask + 1 - rest;
+        chunk = chunk < size - done ? chunk : size - done;
+        int64_t cluster = this->index >> this->cluster_shift;
+        if (cluster > this->used_clusters) {
+            // delayed allocation - clusters are assigned at flush or close
+            auto offset = (size_t) (this->index - this->allocatedEnd());
+            if (this->pending.size() < offset + chunk) {
+                this->pending.resize(offset + chunk, '\0');
+            }
+            memcpy(this->pending.data() + offset, buffer + done, (size_t) chunk);
+        } else {
+            int64_t address = this->clusterAddress(cluster);
+            if (address == -1) {
+                break;
+            }
+            this->fileSystem->write((void *) (buffer + done), chunk, address + rest);
+        }
+        this->index += chunk;
+        done += chunk;
+    }
+    if (this->index > this->new_size) {
+        this->new_size = this->index;
+    }
+    if ((int64_t) this->pending.size() >= DELAYED_WRITE_LIMIT) {
+        this->allocatePending();
+    }
+    return done;
+}
+
+void MemoryIterator::seek(int64_t position) {
+    this->index = position < 0 ? 0 : position;
+}
+
+void MemoryIterator::seekEnd() {
+    // continue right after the last cluster of the file
+    this->index = this->size();
+    if (this->used_clusters >= 0) {
+        this->goal = this->clusterAddress(this->used_clusters);
+    }
+}
+
+int64_t MemoryIterator::tell() const {
+    return this->index;
+}
+
+int64_t MemoryIterator::size() const {
+    return this->writable ? this->new_size : this->inode->inode->file_size;
+}
+
+void MemoryIterator::resize(int64_t size) {
+    this->flush();
+    int64_t position = this->index;
+    if (size < this->new_size) {
+        this->new_size = size;
+        this->close();
+    } else if (size > this->new_size) {
+        this->index = size;
+        this->write(nullptr, 0);
+        this->flush();
+    }
+    this->index = position;
+}
+
+int MemoryIterator::flush() {
+    // keeps clusters past the end - unlike close() nothing is truncated
+    this->allocatePending();
+    if (this->writable && this->new_size > this->inode->inode->file_size) {
+        this->inode->inode->file_size = this->new_size;
+    }
+    this->fileSystem->saveInode(this->inode->inode.get());
+    this->fileSystem->syncChecksums();
+    return this->noSpace ? 1 : 0;
 }
 
 void MemoryIterator::rewind() {
@@ -54,27 +247,42 @@ void MemoryIterator::rewind() {
 
 void MemoryIterator::next() {
     this->index++;
-    // TODO check for max
 }
 
-int32_t MemoryIterator::address() {
-    int cluster = this->index / CLUSTER_SIZE;
-    int rest = this->index % CLUSTER_SIZE;
-//    std::cout << "GETTING - CLUSTER - " << cluster << " - " << rest << std::endl;
+int64_t MemoryIterator::address() {
+    int64_t cluster = this->index >> this->cluster_shift;
+    int64_t rest = this->index & this->cluster_mask;
 
-    if (this->write && this->index > this->new_size) {
+    if (this->writable && this->index >= this->new_size) {
         this->new_size = this->index + 1;
     }
-    int32_t address = this->clusterAddress(cluster) + rest;
-//    std::cout << "GETTING ADDRESS - " << address << std::endl;
 
-    return address;
+    return this->clusterAddress(cluster) + rest;
 }
 
-int32_t MemoryIterator::clusterAddress(int cluster) {
-    int32_t new_cluster = -1;
-    if (this->write && this->used_clusters < cluster) {
-        new_cluster = this->fileSystem->createCluster();
+int64_t MemoryIterator::clusterAddress(int64_t cluster) {
+    int64_t new_cluster = -1;
+    if (this->writable && this->used_clusters < cluster) {
+        // the cluster and the clusters of links it starts are taken together - all or none
+        int64_t links = this->fileSystem->linkClusterCount(cluster + 1) - this->fileSystem->linkClusterCount(cluster);
+        new_cluster = this->allocateCluster();
+        while (new_cluster != -1 && (int64_t) this->link_spare.size() < links) {
+            int64_t link = this->allocateCluster(true);
+            if (link == -1) {
+                for (int64_t spare : this->link_spare) {
+                    this->fileSystem->removeClusterByAddress(spare);
+                }
+                this->link_spare.clear();
+                this->fileSystem->removeClusterByAddress(new_cluster);
+                new_cluster = -1;
+            } else {
+                this->link_spare.push_back(link);
+            }
+        }
+        if (new_cluster == -1) {
+            this->noSpace = true;
+            return -1;
+        }
         this->used_clusters++;
     }
     if (cluster >= 0 && cluster < 5) {
@@ -85,136 +293,446 @@ int32_t MemoryIterator::clusterAddress(int cluster) {
         return this->inode->inode->direct[cluster];
     }
 
-    // INDIRECT 1
+    // same cluster of links as the last lookup - skip the walk from the root
+    int64_t slot = cluster - this->leaf_first;
+    if (this->leaf_node != -1 && slot >= 0 && slot < this->fileSystem->linksPerCluster()) {
+        int64_t address = this->leaf_node + slot * this->fileSystem->linkSize();
+        if (new_cluster != -1) {
+            this->fileSystem->writeLink(address, new_cluster);
+            return new_cluster;
+        }
+        return this->fileSystem->readLink(address);
+    }
+
+    // INDIRECT 1, 2, 3
+    int64_t global = cluster;
     cluster -= 5;
-    if (cluster < LINKS_PER_CLUSTER) {
-        if (new_cluster != -1 && cluster == 0) {
-            // first indirect - cluster for links
-            int new_indirect = this->fileSystem->createCluster();
+    int64_t capacity = 1;
+    for (int32_t level = 1; level <= this->fileSystem->indirectLevels(); ++level) {
+        capacity *= this->fileSystem->linksPerCluster();
+        if (cluster < capacity) {
+            int64_t* root = this->indirectRoot(level);
+            if (new_cluster != -1 && cluster == 0) {
+                // first cluster on this level - cluster for links
+                *root = this->takeLinkCluster();
+            }
+            int64_t address = this->indirectAddress(*root, cluster, level, new_cluster);
+            this->leaf_first = global - cluster % this->fileSystem->linksPerCluster();
+            return address;
+        }
+        cluster -= capacity;
+    }
+
+    // overflow
+    return -1;
+}
+
+int64_t MemoryIterator::allocatedEnd() const {
+    return (this->used_clusters + 1) << this->cluster_shift;
+}
 
-            this->inode->inode->indirect1 = new_indirect;
-//            std::cout << "CREATING INDIRECT1 - " << new_indirect << std::endl;
+void MemoryIterator::allocatePending(int64_t clusters) {
+    // buffered data gets its clusters - at least [0, clusters) are allocated afterwards
+    if (!this->writable || this->inode->isInline()) {
+        return;
+    }
+    int64_t end = this->new_size - this->allocatedEnd();
+    if ((int64_t) this->pending.size() > end) {
+        this->pending.resize(end > 0 ? (size_t) end : 0);
+    }
+    int64_t first = this->used_clusters + 1;
+    int64_t count = ((int64_t) this->pending.size() + this->cluster_mask) >> this->cluster_shift;
+    if (count < clusters - first) {
+        count = clusters - first;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    std::vector<int64_t> addresses = this->appendClusters(count);
+    if ((int64_t) addresses.size() < count) {
+        // out of space - what did not get a cluster is dropped
+        count = (int64_t) addresses.size();
+        this->new_size = std::min(this->new_size, this->allocatedEnd());
+        this->pending.resize(std::min(this->pending.size(), (size_t) (count << this->cluster_shift)));
+    }
+
+    // write contiguous stretches at once
+    int64_t clusterSize = this->cluster_mask + 1;
+    int64_t i = 0;
+    while (i < count && (i << this->cluster_shift) < (int64_t) this->pending.size()) {
+        int64_t stretch = 1;
+        while (i + stretch < count && addresses[i + stretch] == addresses[i + stretch - 1] + clusterSize) {
+            stretch++;
         }
-        int32_t address = this->inode->inode->indirect1 + (cluster * sizeof(int32_t));
-        if (new_cluster != -1) {
-//            std::cout << "INDIRECT1 - " << address << " - CLUSTER - " << cluster << "/" << LINKS_PER_CLUSTER << " - NEW - " << new_cluster << std::endl;
-            // indirect - cluster address in indirect cluster
-            this->fileSystem->write(&new_cluster, sizeof(int32_t), address);
-            return new_cluster;
+        int64_t offset = i << this->cluster_shift;
+        int64_t length = stretch << this->cluster_shift;
+        if (offset + length > (int64_t) this->pending.size()) {
+            length = (int64_t) this->pending.size() - offset;
+        }
+        this->fileSystem->write(this->pending.data() + offset, (size_t) length, addresses[i]);
+        i += stretch;
+    }
+    this->pending.clear();
+}
+
+std::vector<int64_t> MemoryIterator::appendClusters(int64_t count) {
+    int64_t first = this->used_clusters + 1;
+    int64_t clusterSize = this->cluster_mask + 1;
+    int64_t links = this->fileSystem->linkClusterCount(first + count) - this->fileSystem->linkClusterCount(first);
+    int64_t run = this->fileSystem->findFreeRun(count + links, this->goal);
+    if (run != -1 && !this->fileSystem->allocateRun(run, count + links)) {
+        run = -1;
+    }
+
+    std::vector<int64_t> addresses;
+    if (first == 0 && run != -1) {
+        // whole file in one run - clusters of links first, each written once
+        std::vector<int64_t> linkClusters;
+        for (int64_t i = 0; i < links; ++i) {
+            linkClusters.push_back(run + i * clusterSize);
+        }
+        for (int64_t i = 0; i < count; ++i) {
+            addresses.push_back(run + (links + i) * clusterSize);
         }
-        int32_t out;
-        this->fileSystem->read(&out, sizeof(int32_t), address);
-        return out;
+        this->assignClusters(addresses, linkClusters);
+        return addresses;
     }
 
-    // INDIRECT 2
-    cluster -= LINKS_PER_CLUSTER;
-    int root = cluster / LINKS_PER_CLUSTER;
-    cluster %= LINKS_PER_CLUSTER;
-    if (root >= LINKS_PER_CLUSTER) {
-        // overflow
-        return -1;
+    // appended clusters come from the reserved run while it lasts
+    this->reserved_next = run;
+    this->reserved_left = run != -1 ? count + links : 0;
+    for (int64_t i = 0; i < count; ++i) {
+        int64_t address = this->clusterAddress(first + i);
+        if (address == -1) {
+            break;
+        }
+        addresses.push_back(address);
+    }
+    for (; this->reserved_left > 0; this->reserved_left--, this->reserved_next += clusterSize) {
+        this->fileSystem->removeClusterByAddress(this->reserved_next);
+    }
+    return addresses;
+}
+
+int MemoryIterator::allocate(int64_t size, bool keepSize) {
+    // like posix_fallocate - space is checked before anything is allocated
+    if (!this->writable || size <= 0) {
+        return 0;
+    }
+    if (size > this->fileSystem->maxFileSize()) {
+        return 2;
+    }
+    bool fitsInline = this->inode->isInline() && size <= this->fileSystem->inlineDataSize();
+    int64_t clusters = fitsInline ? 0 : (size + this->cluster_mask) >> this->cluster_shift;
+    int64_t first = this->inode->isInline() ? 0 : this->used_clusters + 1;
+    if (clusters > first) {
+        int64_t links = this->fileSystem->linkClusterCount(clusters) - this->fileSystem->linkClusterCount(first);
+        if (clusters - first + links > this->fileSystem->freeClusters()) {
+            return 1;
+        }
+        if (this->inode->isInline()) {
+            this->promoteInline();
+        }
+        this->allocatePending(clusters);
+        if (this->noSpace) {
+            return 1;
+        }
     }
-    if (new_cluster != -1 && cluster == 0 && root == 0) {
-        // first indirect2 - cluster for links of links
-        int new_indirect = this->fileSystem->createCluster();
 
-        this->inode->inode->indirect2 = new_indirect;
+    if (!keepSize && size > this->new_size) {
+        // the new range reads as zeros
+        int64_t position = this->index;
+        this->index = size;
+        this->write(nullptr, 0);
+        this->index = position;
     }
-    // READ INDIRECT 2 -> READ INDIRECT -> clusterAddress
-    int32_t address = this->inode->inode->indirect2 + (root * sizeof(int32_t));
-    if (new_cluster != -1 && cluster == 0) {
-        // first link in new cluster of links
-        int new_indirect = this->fileSystem->createCluster();
+    return 0;
+}
 
-        this->fileSystem->write(&new_indirect, sizeof(int32_t), address);
+int64_t MemoryIterator::allocateCluster(bool link) {
+    // reserved run - data from its front, clusters of links from its back
+    if (this->reserved_left > 0 && link) {
+        this->reserved_left--;
+        return this->reserved_next + (this->reserved_left << this->cluster_shift);
+    }
+    if (this->reserved_left > 0) {
+        int64_t reserved = this->reserved_next;
+        this->reserved_next += this->cluster_mask + 1;
+        this->reserved_left--;
+        this->goal = reserved;
+        return reserved;
     }
-    this->fileSystem->read(&address, sizeof(int32_t), address);
-    address += (cluster * sizeof(int32_t));
-    if (new_cluster != -1) {
-        this->fileSystem->write(&new_cluster, sizeof(int32_t), address);
-        return new_cluster;
+    int64_t cluster = this->fileSystem->createCluster(this->goal);
+    if (cluster != -1) {
+        this->goal = cluster;
     }
-    this->fileSystem->read(&address, sizeof(int32_t), address);
+    return cluster;
+}
 
-    return address;
+int64_t MemoryIterator::takeLinkCluster() {
+    // allocated ahead by clusterAddress, in the order they are needed
+    int64_t link = this->link_spare.front();
+    this->link_spare.erase(this->link_spare.begin());
+    return link;
 }
 
-void MemoryIterator::truncate(int32_t truncateSize) {
-    int to = (truncateSize - 1) / CLUSTER_SIZE;
-    int from = (this->inode->inode->file_size - 1) / CLUSTER_SIZE;
-    if (truncateSize == 0) {
-        to = -1;
+int64_t* MemoryIterator::indirectRoot(int32_t level) {
+    switch (level) {
+        case 1:
+            return &this->inode->inode->indirect1;
+        case 2:
+            return &this->inode->inode->indirect2;
+        default:
+            return &this->inode->inode->indirect3;
     }
+}
 
-    if (to >= from) {
-        return;
+int64_t MemoryIterator::indirectAddress(int64_t root, int64_t cluster, int32_t level, int64_t newCluster) {
+    // READ INDIRECT N -> ... -> READ INDIRECT 1 -> clusterAddress
+    int64_t span = 1;
+    for (int32_t i = 1; i < level; ++i) {
+        span *= this->fileSystem->linksPerCluster();
     }
 
-    if (to < 4) {
-        int max = from > 4 ? 4 : from;
-        for (int i = to + 1; i <= max; ++i) {
-            this->fileSystem->removeClusterByAddress(this->inode->inode->direct[i]);
+    int64_t node = root;
+    while (true) {
+        int64_t address = node + (cluster / span) * this->fileSystem->linkSize();
+        cluster %= span;
+        if (span == 1) {
+            this->leaf_node = node;
+            if (newCluster != -1) {
+                // cluster address in indirect cluster
+                this->fileSystem->writeLink(address, newCluster);
+                return newCluster;
+            }
+            return this->fileSystem->readLink(address);
+        }
+        if (newCluster != -1 && cluster == 0) {
+            // first link in new cluster of links
+            node = this->takeLinkCluster();
+            this->fileSystem->writeLink(address, node);
+        } else {
+            node = this->fileSystem->readLink(address);
         }
+        span /= this->fileSystem->linksPerCluster();
+    }
+}
+
+void MemoryIterator::truncate(int64_t truncateSize) {
+    if (this->inode->isInline() || this->inode->inode->file_size <= 0) {
+        return;
     }
-    if (from < 5) {
+
+    // clusters [keep, used) are released
+    int64_t keep = (truncateSize + this->cluster_mask) >> this->cluster_shift;
+    int64_t used = (this->inode->inode->file_size + this->cluster_mask) >> this->cluster_shift;
+    if (keep >= used) {
         return;
     }
 
-    // INDIRECT 1
-    from -= 5;
-    to -= 5;
-    to = to > 0 ? to : 0;
-    if (to < LINKS_PER_CLUSTER) {
-        int max = from > LINKS_PER_CLUSTER ? LINKS_PER_CLUSTER : from;
-        for (int i = to; i < max; ++i) {
-            int32_t address = this->inode->inode->indirect1 + (i * sizeof(int32_t));
-            int32_t out;
-            this->fileSystem->read(&out, sizeof(int32_t), address);
-            this->fileSystem->removeClusterByAddress(out);
+    for (int64_t i = keep; i < used && i < 5; ++i) {
+        this->fileSystem->removeClusterByAddress(this->inode->inode->direct[i]);
+    }
+
+    int64_t start = 5;
+    int64_t capacity = 1;
+    for (int32_t level = 1; level <= this->fileSystem->indirectLevels() && start < used; ++level) {
+        capacity *= this->fileSystem->linksPerCluster();
+        int64_t first = keep > start ? keep - start : 0;
+        int64_t last = (used < start + capacity ? used : start + capacity) - start - 1;
+        if (first <= last) {
+            this->truncateIndirect(*this->indirectRoot(level), first, last, level);
+        }
+        start += capacity;
+    }
+    this->used_clusters = keep - 1;
+    this->leaf_node = -1;
+}
+
+void MemoryIterator::truncateIndirect(int64_t root, int64_t first, int64_t last, int32_t level) {
+    int64_t span = 1;
+    for (int32_t i = 1; i < level; ++i) {
+        span *= this->fileSystem->linksPerCluster();
+    }
+
+    std::vector<int64_t> links = this->fileSystem->readLinks(root);
+    for (int64_t slot = first / span; slot <= last / span; ++slot) {
+        if (level == 1) {
+            this->fileSystem->removeClusterByAddress(links[slot]);
+            continue;
         }
+        int64_t from = first - slot * span;
+        int64_t to = last - slot * span;
+        this->truncateIndirect(links[slot], from > 0 ? from : 0, to < span - 1 ? to : span - 1, level - 1);
     }
 
-    if (to < 5) {
-        this->fileSystem->removeClusterByAddress(this->inode->inode->indirect1);
+    if (first == 0) {
+        this->fileSystem->removeClusterByAddress(root);
     }
-    if (from < LINKS_PER_CLUSTER) {
+}
+
+void MemoryIterator::promoteInline() {
+    // inline data outgrew the inode - it moves to the buffer of unallocated data
+    int32_t size = this->fileSystem->inlineDataSize();
+    this->pending.assign(this->inode->inlineData(), this->inode->inlineData() + (this->new_size < size ? this->new_size : size));
+    memset(this->inode->inlineData(), 0, INLINE_DATA_SIZE);
+    this->inode->inode->flags &= ~INODE_FLAG_INLINE;
+    this->used_clusters = -1;
+}
+
+void MemoryIterator::demoteInline() {
+    // data fits into the inode - move it back and release clusters
+    char data[INLINE_DATA_SIZE];
+    int64_t position = this->index;
+    this->index = 0;
+    this->read(data, this->new_size);
+    this->index = position;
+    this->pending.clear();
+    if (this->used_clusters >= 0) {
+        this->inode->inode->file_size = (this->used_clusters + 1) << this->cluster_shift;
+        this->truncate(0);
+    }
+    memset(this->inode->inlineData(), 0, INLINE_DATA_SIZE);
+    memcpy(this->inode->inlineData(), data, this->new_size);
+    this->inode->inode->flags |= INODE_FLAG_INLINE;
+    this->used_clusters = -1;
+}
+
+void MemoryIterator::blockMap(std::vector<int64_t>& data, std::vector<int64_t>& links) {
+    if (this->inode->isInline() || this->inode->inode->file_size <= 0) {
         return;
     }
+    int64_t used = (this->inode->inode->file_size + this->cluster_mask) >> this->cluster_shift;
+    for (int64_t i = 0; i < used && i < 5; ++i) {
+        data.push_back(this->inode->inode->direct[i]);
+    }
 
-    // INDIRECT 2
-    from -= LINKS_PER_CLUSTER;
-    to -= LINKS_PER_CLUSTER;
-    to = to > 0 ? to : 0;
-
-    // READ INDIRECT 2 -> READ INDIRECT -> clusterAddress
-    int root = to / LINKS_PER_CLUSTER;
-    int32_t rootAddress = this->inode->inode->indirect2 + (root * sizeof(int32_t));
-    this->fileSystem->read(&rootAddress, sizeof(int32_t), rootAddress);
-    int cluster = to % LINKS_PER_CLUSTER;
-    bool fromStart = cluster == 0;
-    for (int i = to; i <= from; ++i) {
-        if (cluster >= LINKS_PER_CLUSTER) {
-            if (fromStart) {
-                this->fileSystem->removeClusterByAddress(rootAddress);
-            }
-            fromStart = true;
-            root++;
-            rootAddress = this->inode->inode->indirect2 + (root * sizeof(int32_t));
-            this->fileSystem->read(&rootAddress, sizeof(int32_t), rootAddress);
-            cluster %= LINKS_PER_CLUSTER;
+    int64_t start = 5;
+    int64_t capacity = 1;
+    for (int32_t level = 1; level <= this->fileSystem->indirectLevels() && start < used; ++level) {
+        capacity *= this->fileSystem->linksPerCluster();
+        int64_t count = used - start < capacity ? used - start : capacity;
+        this->blockMapIndirect(*this->indirectRoot(level), count, level, data, links);
+        start += capacity;
+    }
+}
+
+void MemoryIterator::blockMapIndirect(int64_t root, int64_t count, int32_t level, std::vector<int64_t>& data, std::vector<int64_t>& links) {
+    int64_t span = 1;
+    for (int32_t i = 1; i < level; ++i) {
+        span *= this->fileSystem->linksPerCluster();
+    }
+
+    links.push_back(root);
+    std::vector<int64_t> nodeLinks = this->fileSystem->readLinks(root);
+    for (int64_t slot = 0; slot * span < count; ++slot) {
+        if (level == 1) {
+            data.push_back(nodeLinks[slot]);
+            continue;
         }
+        int64_t left = count - slot * span;
+        this->blockMapIndirect(nodeLinks[slot], left < span ? left : span, level - 1, data, links);
+    }
+}
 
-        int32_t address = rootAddress + (cluster * sizeof(int32_t));
-        this->fileSystem->read(&address, sizeof(int32_t), address);
-        this->fileSystem->removeClusterByAddress(address);
-        cluster++;
+void MemoryIterator::assignClusters(const std::vector<int64_t>& data, const std::vector<int64_t>& links) {
+    // write the whole block map at once - every cluster of links is written exactly once
+    auto count = (int64_t) data.size();
+    for (int64_t i = 0; i < count && i < 5; ++i) {
+        this->inode->inode->direct[i] = data[i];
+    }
+
+    auto link = links.cbegin();
+    int64_t start = 5;
+    int64_t capacity = 1;
+    for (int32_t level = 1; level <= this->fileSystem->indirectLevels() && start < count; ++level) {
+        capacity *= this->fileSystem->linksPerCluster();
+        int64_t onLevel = count - start < capacity ? count - start : capacity;
+        *this->indirectRoot(level) = this->assignIndirect(data.data() + start, onLevel, level, link);
+        start += capacity;
     }
 
-    if (fromStart) {
-        this->fileSystem->removeClusterByAddress(rootAddress);
+    this->used_clusters = count - 1;
+    this->leaf_node = -1;
+    if (count > 0) {
+        this->goal = data.back();
     }
-    if (to <= 0) {
-        this->fileSystem->removeClusterByAddress(this->inode->inode->indirect2);
+}
+
+int64_t MemoryIterator::assignIndirect(const int64_t* data, int64_t count, int32_t level, std::vector<int64_t>::const_iterator& links) {
+    int64_t span = 1;
+    for (int32_t i = 1; i < level; ++i) {
+        span *= this->fileSystem->linksPerCluster();
+    }
+
+    int64_t node = *links++;
+    std::vector<int64_t> nodeLinks(this->fileSystem->linksPerCluster(), 0);
+    for (int64_t slot = 0; slot * span < count; ++slot) {
+        if (level == 1) {
+            nodeLinks[slot] = data[slot];
+            continue;
+        }
+        int64_t left = count - slot * span;
+        nodeLinks[slot] = this->assignIndirect(data + slot * span, left < span ? left : span, level - 1, links);
+    }
+    this->fileSystem->writeLinks(node, nodeLinks);
+    return node;
+}
+
+bool MemoryIterator::relocate() {
+    // move the file into one contiguous run - clusters of links first, data after them
+    std::vector<int64_t> data;
+    std::vector<int64_t> links;
+    this->blockMap(data, links);
+
+    int64_t clusterSize = this->fileSystem->clusterSize();
+    bool contiguous = true;
+    for (size_t i = 1; i < data.size() && contiguous; ++i) {
+        contiguous = data[i] == data[i - 1] + clusterSize;
+    }
+    if (contiguous) {
+        return false;
+    }
+
+    auto count = (int64_t) (data.size() + links.size());
+    int64_t start = this->fileSystem->findFreeRun(count, data.front());
+    if (start == -1 || !this->fileSystem->allocateRun(start, count)) {
+        return false;
+    }
+
+    std::vector<int64_t> newLinks;
+    std::vector<int64_t> newData;
+    for (size_t i = 0; i < links.size(); ++i) {
+        newLinks.push_back(start + (int64_t) i * clusterSize);
+    }
+    for (size_t i = 0; i < data.size(); ++i) {
+        newData.push_back(start + (int64_t) (links.size() + i) * clusterSize);
+    }
+
+    // copy source extents in chunks
+    const size_t chunkClusters = 256;
+    std::vector<char> buffer;
+    size_t i = 0;
+    while (i < data.size()) {
+        size_t run = 1;
+        while (i + run < data.size() && run < chunkClusters && data[i + run] == data[i + run - 1] + clusterSize) {
+            run++;
+        }
+        buffer.resize(run * clusterSize);
+        this->fileSystem->read(buffer.data(), buffer.size(), data[i]);
+        this->fileSystem->write(buffer.data(), buffer.size(), newData[i]);
+        i += run;
+    }
+
+    this->assignClusters(newData, newLinks);
+    this->fileSystem->saveInode(this->inode->inode.get());
+
+    for (int64_t address : data) {
+        this->fileSystem->removeClusterByAddress(address);
+    }
+    for (int64_t address : links) {
+        this->fileSystem->removeClusterByAddress(address);
     }
+    return true;
 }
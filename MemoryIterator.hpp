@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include "consts.hpp"
 
 class INode;
@@ -8,24 +9,63 @@ class FileSystem;
 
 class MemoryIterator {
 public:
-    MemoryIterator(std::shared_ptr<INode> inode, std::shared_ptr<FileSystem> fileSystem, bool write);
+    MemoryIterator(std::shared_ptr<INode> inode, std::shared_ptr<FileSystem> fileSystem, bool write, bool overwrite = true);
+    MemoryIterator(INode& inode, FileSystem& fileSystem, bool write, bool overwrite = true);
     void rewind();
     void next();
-    int32_t address();
-    int32_t clusterAddress(int cluster);
-    void truncate(int32_t truncateSize);
+    int64_t address();
+    int64_t clusterAddress(int64_t cluster);
+    void truncate(int64_t truncateSize);
+    void blockMap(std::vector<int64_t>& data, std::vector<int64_t>& links);
+    void assignClusters(const std::vector<int64_t>& data, const std::vector<int64_t>& links);
+    bool relocate();
     void writec(char c);
     int readc();
-    void close();
+    int64_t read(char* buffer, int64_t size);
+    int64_t write(const char* buffer, int64_t size);
+    void seek(int64_t position);
+    void seekEnd();
+    int64_t tell() const;
+    int64_t size() const;
+    void resize(int64_t size);
+    int flush();
+    int allocate(int64_t size, bool keepSize = false);
+    int close();
     bool readDone = false;
+    bool corrupted = false;
+    bool noSpace = false;
 protected:
-    std::shared_ptr<INode> inode;
-    std::shared_ptr<FileSystem> fileSystem;
-    bool write;
-    int32_t used_clusters;
-    int32_t index;
-    int32_t new_size;
-};
-
-
+    // owners are held only by iterators that outlive the call creating them
+    std::shared_ptr<INode> inodeOwner;
+    std::shared_ptr<FileSystem> fileSystemOwner;
+    INode* inode;
+    FileSystem* fileSystem;
+    bool writable;
+    int64_t used_clusters;
+    int64_t index;
+    int64_t new_size;
+    int32_t cluster_shift;
+    int64_t cluster_mask;
+    int64_t goal;
+    int64_t leaf_node = -1;
+    int64_t leaf_first = -1;
+    std::vector<char> pending;
+    int64_t reserved_next = -1;
+    int64_t reserved_left = 0;
+    int64_t verified_cluster = -1;
+    std::vector<char> scratch;
+    std::vector<int64_t> link_spare;
 
+    int64_t allocatedEnd() const;
+    void allocatePending(int64_t clusters = 0);
+    std::vector<int64_t> appendClusters(int64_t count);
+    int64_t allocateCluster(bool link = false);
+    int64_t takeLinkCluster();
+    int64_t* indirectRoot(int32_t level);
+    int64_t indirectAddress(int64_t root, int64_t cluster, int32_t level, int64_t newCluster);
+    void blockMapIndirect(int64_t root, int64_t count, int32_t level, std::vector<int64_t>& data, std::vector<int64_t>& links);
+    int64_t assignIndirect(const int64_t* data, int64_t count, int32_t level, std::vector<int64_t>::const_iterator& links);
+    void truncateIndirect(int64_t root, int64_t first, int64_t last, int32_t level);
+    void promoteInline();
+    void demoteInline();
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+// free list of equally sized blocks, carved from chunks that are never returned
+template <size_t Size, size_t Align>
+class BlockPool {
+public:
+    static BlockPool& instance() {
+        static BlockPool pool;
+        return pool;
+    }
+
+    void* allocate() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->free == nullptr) {
+            this->grow();
+        }
+        Block* block = this->free;
+        this->free = block->next;
+        return block;
+    }
+
+    void deallocate(void* pointer) {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        auto block = static_cast<Block*>(pointer);
+        block->next = this->free;
+        this->free = block;
+    }
+
+private:
+    union Block {
+        Block* next;
+        alignas(Align) unsigned char data[Size];
+    };
+    static const size_t CHUNK_BLOCKS = 256;
+
+    std::mutex mutex;
+    Block* free = nullptr;
+    std::vector<std::unique_ptr<Block[]>> chunks;
+
+    BlockPool() = default;
+
+    void grow() {
+        this->chunks.emplace_back(new Block[CHUNK_BLOCKS]);
+        Block* chunk = this->chunks.back().get();
+        for (size_t i = 0; i < CHUNK_BLOCKS; ++i) {
+            chunk[i].next = this->free;
+            this->free = &chunk[i];
+        }
+    }
+};
+
+// allocator for allocate_shared - the object and its control block come from one pooled block
+template <typename T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t count) {
+        if (count != 1) {
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        }
+        return static_cast<T*>(BlockPool<sizeof(T), alignof(T)>::instance().allocate());
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        if (count != 1) {
+            ::operator delete(pointer);
+            return;
+        }
+        BlockPool<sizeof(T), alignof(T)>::instance().deallocate(pointer);
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>&) const { return false; }
+};
+
+template <typename T, typename... Args>
+std::shared_ptr<T> makePooled(Args&&... args) {
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include "Scrubber.hpp"
+
+Scrubber::Scrubber(std::shared_ptr<FileSystem> fileSystem) {
+    this->fileSystem = std::move(fileSystem);
+}
+
+Scrubber::~Scrubber() {
+    this->stop();
+}
+
+void Scrubber::start(int64_t rate) {
+    this->stop();
+    this->stopping = false;
+    this->active = true;
+    this->checkedClusters = 0;
+    this->badClusters.clear();
+    this->worker = std::thread([this, rate] { this->run(rate); });
+}
+
+void Scrubber::stop() {
+    this->stopping = true;
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+}
+
+bool Scrubber::running() const {
+    return this->active;
+}
+
+int64_t Scrubber::checked() const {
+    return this->checkedClusters;
+}
+
+int64_t Scrubber::total() const {
+    return this->totalClusters;
+}
+
+std::vector<int64_t> Scrubber::errors() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->badClusters;
+}
+
+void Scrubber::run(int64_t rate) {
+    // rate in bytes per second, 0 runs at full speed
+    const int64_t batch = 64;
+    this->fileSystem->syncChecksums();
+    this->totalClusters = this->fileSystem->usedClusters();
+    int64_t clusterSize = this->fileSystem->clusterSize();
+    std::vector<char> buffer(batch * clusterSize);
+    auto started = std::chrono::steady_clock::now();
+    int64_t bytes = 0;
+
+    int64_t count = this->fileSystem->clusterIndexCount();
+    int64_t index = 0;
+    while (index < count && !this->stopping) {
+        if (!this->fileSystem->isClusterUsed(index)) {
+            index++;
+            continue;
+        }
+        // a run of used clusters is read at once
+        int64_t address = this->fileSystem->indexAddress(index);
+        int64_t run = 1;
+        while (run < batch && index + run < count && this->fileSystem->isClusterUsed(index + run)
+               && this->fileSystem->indexAddress(index + run) == address + run * clusterSize) {
+            run++;
+        }
+        this->fileSystem->read(buffer.data(), run * clusterSize, address);
+        for (int64_t i = 0; i < run; ++i) {
+            // clusters written or freed since the read are skipped, not reported
+            if (!this->fileSystem->verifyCluster(address + i * clusterSize, buffer.data() + i * clusterSize)
+                && this->fileSystem->isClusterUsed(index + i)) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->badClusters.push_back(address + i * clusterSize);
+            }
+        }
+        this->checkedClusters += run;
+        index += run;
+
+        bytes += run * clusterSize;
+        if (rate > 0) {
+            auto due = started + std::chrono::microseconds(bytes * 1000000 / rate);
+            std::this_thread::sleep_until(due);
+        }
+    }
+    this->active = false;
+}
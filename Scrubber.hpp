@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FileSystem.hpp"
+
+class Scrubber {
+public:
+    explicit Scrubber(std::shared_ptr<FileSystem> fileSystem);
+    ~Scrubber();
+
+    void start(int64_t rate);
+    void stop();
+    bool running() const;
+    int64_t checked() const;
+    int64_t total() const;
+    std::vector<int64_t> errors();
+
+protected:
+    std::shared_ptr<FileSystem> fileSystem;
+    std::thread worker;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> active{false};
+    std::atomic<int64_t> checkedClusters{0};
+    std::atomic<int64_t> totalClusters{0};
+    std::mutex mutex;
+    std::vector<int64_t> badClusters;
+
+    void run(int64_t rate);
+};
@@ -0,0 +1,108 @@
+#include <cstring>
+#include "Searcher.hpp"
+#include "MemoryIterator.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// bytes read from a file per step
+static const size_t SEARCH_CHUNK = 1 << 20;
+
+void Searcher::scan(const char* data, size_t size, const std::string& pattern, int64_t base, std::vector<int64_t>& offsets) {
+    // vector kernels take whole blocks of candidate positions, the tail is checked byte by byte
+    size_t length = pattern.size();
+    if (length == 0 || size < length) {
+        return;
+    }
+    size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool useAvx2 = avx2Supported();
+    i = useAvx2 ? avx2(data, size, pattern, base, offsets) : sse2(data, size, pattern, base, offsets);
+#endif
+    for (; i + length <= size; ++i) {
+        if (data[i] == pattern[0] && memcmp(data + i, pattern.data(), length) == 0) {
+            offsets.push_back(base + (int64_t) i);
+        }
+    }
+}
+
+bool Searcher::avx2Supported() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+size_t Searcher::sse2(const char* data, size_t size, const std::string& pattern, int64_t base, std::vector<int64_t>& offsets) {
+    // positions whose first and last byte both fit the pattern are verified with memcmp
+    size_t length = pattern.size();
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[length - 1]);
+    size_t i = 0;
+    for (; i + 16 + length - 1 <= size; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + length - 1));
+        auto mask = (uint32_t) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while (mask != 0) {
+            size_t position = i + __builtin_ctz(mask);
+            if (memcmp(data + position, pattern.data(), length) == 0) {
+                offsets.push_back(base + (int64_t) position);
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+size_t Searcher::avx2(const char* data, size_t size, const std::string& pattern, int64_t base, std::vector<int64_t>& offsets) {
+    // the same filter over 32 positions at a time
+    size_t length = pattern.size();
+    const __m256i first = _mm256_set1_epi8(pattern[0]);
+    const __m256i last = _mm256_set1_epi8(pattern[length - 1]);
+    size_t i = 0;
+    for (; i + 32 + length - 1 <= size; i += 32) {
+        __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        __m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i + length - 1));
+        auto mask = (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+        while (mask != 0) {
+            size_t position = i + __builtin_ctz(mask);
+            if (memcmp(data + position, pattern.data(), length) == 0) {
+                offsets.push_back(base + (int64_t) position);
+            }
+            mask &= mask - 1;
+        }
+    }
+    return i;
+}
+#else
+size_t Searcher::sse2(const char*, size_t, const std::string&, int64_t, std::vector<int64_t>&) {
+    return 0;
+}
+
+size_t Searcher::avx2(const char*, size_t, const std::string&, int64_t, std::vector<int64_t>&) {
+    return 0;
+}
+#endif
+
+int Searcher::searchFile(const std::shared_ptr<INode>& file, const std::shared_ptr<FileSystem>& fileSystem,
+                         const std::string& pattern, std::vector<int64_t>& offsets) {
+    // the last length - 1 bytes of a chunk stay in front of the next one, so a match across the boundary is found once
+    size_t keep = pattern.size() - 1;
+    std::vector<char> buffer(keep + SEARCH_CHUNK);
+    MemoryIterator input(*file, *fileSystem, false);
+    size_t kept = 0;
+    int64_t position = 0;
+    int64_t r;
+    while ((r = input.read(buffer.data() + kept, SEARCH_CHUNK)) > 0) {
+        size_t total = kept + (size_t) r;
+        scan(buffer.data(), total, pattern, position, offsets);
+        kept = total < keep ? total : keep;
+        memmove(buffer.data(), buffer.data() + total - kept, kept);
+        position += (int64_t) (total - kept);
+    }
+    return input.corrupted ? 1 : 0;
+}
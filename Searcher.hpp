@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FileSystem.hpp"
+
+class Searcher {
+public:
+    static void scan(const char* data, size_t size, const std::string& pattern, int64_t base, std::vector<int64_t>& offsets);
+    static int searchFile(const std::shared_ptr<INode>& file, const std::shared_ptr<FileSystem>& fileSystem,
+                          const std::string& pattern, std::vector<int64_t>& offsets);
+    static bool avx2Supported();
+
+private:
+    static size_t sse2(const char* data, size_t size, const std::string& pattern, int64_t base, std::vector<int64_t>& offsets);
+    static size_t avx2(const char* data, size_t size, const std::string& pattern, int64_t base, std::vector<int64_t>& offsets);
+};
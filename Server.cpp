@@ -0,0 +1,150 @@
+#include <arpa/inet.h>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include "Server.hpp"
+
+// largest request accepted from a client
+const uint32_t MAX_FRAME_SIZE = 1 << 20;
+
+Server::Server(std::shared_ptr<System> system, std::string socketPath) {
+    this->system = std::move(system);
+    this->console = std::make_shared<Console>(this->system);
+    this->socketPath = std::move(socketPath);
+}
+
+int Server::run() {
+    sockaddr_un address{};
+    if (this->socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "INVALID SOCKET PATH" << std::endl;
+        return 1;
+    }
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, this->socketPath.c_str());
+
+    // a client that disconnects mid-response must not kill the daemon
+    signal(SIGPIPE, SIG_IGN);
+    this->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(this->socketPath.c_str());
+    if (this->listener < 0 || bind(this->listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(this->listener, 16) != 0) {
+        std::cerr << "CANNOT LISTEN" << std::endl;
+        return 1;
+    }
+    std::cout << "LISTENING " << this->socketPath << std::endl;
+
+    int client;
+    while ((client = accept(this->listener, nullptr, nullptr)) >= 0) {
+        std::lock_guard<std::mutex> lock(this->clientMutex);
+        if (this->stopping) {
+            close(client);
+            break;
+        }
+        this->clients.insert(client);
+        std::thread(&Server::serve, this, client).detach();
+    }
+
+    // connected clients are cut off and waited for, the image is unmounted with the System
+    {
+        std::unique_lock<std::mutex> lock(this->clientMutex);
+        this->stopping = true;
+        for (int socket : this->clients) {
+            shutdown(socket, SHUT_RDWR);
+        }
+        this->finished.wait(lock, [this] { return this->clients.empty(); });
+    }
+    close(this->listener);
+    unlink(this->socketPath.c_str());
+    return 0;
+}
+
+void Server::serve(int client) {
+    // every client has its own working directory
+    std::string pwd = "/";
+    std::string line;
+    while (receiveFrame(client, line, MAX_FRAME_SIZE)) {
+        if (line == "shutdown") {
+            sendFrame(client, "OK\n") && sendFrame(client, pwd);
+            this->stop();
+            break;
+        }
+        std::string output = this->execute(line, pwd);
+        if (!sendFrame(client, output) || !sendFrame(client, pwd)) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->clientMutex);
+    this->clients.erase(client);
+    close(client);
+    this->finished.notify_all();
+}
+
+std::string Server::execute(const std::string& line, std::string& pwd) {
+    // commands run one at a time, their output is captured for the client that sent them
+    std::lock_guard<std::mutex> lock(this->commandMutex);
+    std::stringstream output;
+    std::streambuf *out = std::cout.rdbuf(output.rdbuf());
+    std::streambuf *err = std::cerr.rdbuf(output.rdbuf());
+    this->system->pwd = pwd;
+    try {
+        this->console->readLine(line);
+    } catch (const std::exception &) {
+        std::cerr << "INVALID ARGUMENT" << std::endl;
+    }
+    pwd = this->system->pwd;
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+    return output.str();
+}
+
+void Server::stop() {
+    std::lock_guard<std::mutex> lock(this->clientMutex);
+    this->stopping = true;
+    shutdown(this->listener, SHUT_RDWR);
+}
+
+bool Server::sendFrame(int socket, const std::string& data) {
+    // 4-byte length in network order, then the bytes
+    uint32_t length = htonl((uint32_t) data.size());
+    std::string frame(reinterpret_cast<const char *>(&length), sizeof(length));
+    frame += data;
+    size_t done = 0;
+    while (done < frame.size()) {
+        ssize_t sent = send(socket, frame.data() + done, frame.size() - done, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        done += sent;
+    }
+    return true;
+}
+
+bool Server::receiveFrame(int socket, std::string& data, uint32_t limit) {
+    auto receive = [socket](char *buffer, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t r = recv(socket, buffer + done, size - done, 0);
+            if (r <= 0) {
+                return false;
+            }
+            done += r;
+        }
+        return true;
+    };
+    uint32_t length = 0;
+    if (!receive(reinterpret_cast<char *>(&length), sizeof(length))) {
+        return false;
+    }
+    length = ntohl(length);
+    if (length > limit) {
+        return false;
+    }
+    data.resize(length);
+    return length == 0 || receive(&data[0], length);
+}
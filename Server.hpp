@@ -0,0 +1,35 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include "System.hpp"
+#include "Console.hpp"
+
+class Server {
+public:
+    Server(std::shared_ptr<System> system, std::string socketPath);
+
+    int run();
+
+    static bool sendFrame(int socket, const std::string& data);
+    static bool receiveFrame(int socket, std::string& data, uint32_t limit = UINT32_MAX);
+
+protected:
+    std::shared_ptr<System> system;
+    std::shared_ptr<Console> console;
+    std::string socketPath;
+    int listener = -1;
+    std::mutex commandMutex;
+    std::mutex clientMutex;
+    std::condition_variable finished;
+    std::set<int> clients;
+    bool stopping = false;
+
+    void serve(int client);
+    std::string execute(const std::string& line, std::string& pwd);
+    void stop();
+};
@@ -1,18 +1,43 @@
+#include <atomic>
 #include <cstring>
+#include <chrono>
+#include <future>
+#include <mutex>
 #include <stack>
 #include "unistd.h"
+#include <fnmatch.h>
+#include <sys/stat.h>
 #include "System.hpp"
+#include "Checker.hpp"
+#include "TreeWalker.hpp"
+#include "Importer.hpp"
+#include "Archive.hpp"
+#include "ThreadPool.hpp"
+#include "Searcher.hpp"
 
 System::System(const std::string& file) {
     this->fileSystem = std::make_shared<FileSystem>(file);
     this->loaded = false;
-    if (access(file.c_str(), R_OK) == 0) {
-        this->fileSystem->load();
-        this->loaded = true;
+    if (this->fileSystem->exists()) {
+        if (this->fileSystem->load() != 0) {
+            std::cerr << "INVALID VOLUME" << std::endl;
+        } else {
+            this->loaded = true;
+        }
     }
     this->pwd = "/";
 }
 
+System::~System() {
+    if (this->scrubber != nullptr) {
+        this->scrubber->stop();
+    }
+    // buffered writes of files left open are allocated now
+    for (auto &file : this->openFiles) {
+        file.second.file->close();
+    }
+}
+
 int System::checkLoaded() {
     if (this->loaded) {
         return 0;
@@ -23,41 +48,33 @@ int System::checkLoaded() {
 }
 
 std::shared_ptr<Directory> System::getDirectory(const std::string& path, bool ignoreLast) {
-    auto directoryInode = this->fileSystem->getInode(0); // root directory
-    auto directory = std::make_shared<Directory>(directoryInode, this->fileSystem);
-    if (path == "/") {
-        return directory;
+    // components are resolved by id in one stack record - only the resulting directory is loaded whole
+    pseudo_inode record{};
+    INode current(std::shared_ptr<pseudo_inode>(std::shared_ptr<pseudo_inode>(), &record));
+    if (!this->fileSystem->readInode(0, record)) { // root directory
+        return nullptr;
     }
-    auto start = 1;
-    auto end = path.find('/', start);
-    std::string part;
-    while (end != std::string::npos && directory != nullptr)
-    {
-        part = path.substr(start, end - start);
-        directoryInode = directory->getItem(part);
-        if (directoryInode == nullptr || !directoryInode->inode->isDirectory) {
-            return nullptr;
+    if (path != "/") {
+        size_t last = path.find_last_of('/');
+        size_t stop = ignoreLast || last + 1 == path.size() ? last : path.size();
+        size_t start = 1;
+        while (start <= stop && stop != std::string::npos) {
+            size_t end = path.find('/', start);
+            if (end == std::string::npos || end > stop) {
+                end = stop;
+            }
+            int32_t id = Directory::lookup(current, path.substr(start, end - start), *this->fileSystem);
+            if (id < 0 || !this->fileSystem->readInode(id, record) || !record.isDirectory) {
+                return nullptr;
+            }
+            start = end + 1;
         }
-        directory = std::make_shared<Directory>(directoryInode, this->fileSystem);
-        start = end + 1;
-        end = path.find('/', start);
-    }
-
-    if (ignoreLast) {
-        return directory;
     }
-
-    part = path.substr(start, end);
-    if (!part.empty()) {
-        directoryInode = directory->getItem(part);
-        if (directoryInode == nullptr || !directoryInode->inode->isDirectory) {
-            return nullptr;
-        }
-
-        return std::make_shared<Directory>(directoryInode, this->fileSystem);
+    std::shared_ptr<INode> directoryInode = this->fileSystem->getInode(record.node_id);
+    if (directoryInode == nullptr) {
+        return nullptr;
     }
-
-    return directory;
+    return makePooled<Directory>(directoryInode, this->fileSystem);
 }
 
 int System::createDirectory(const std::string &path) {
@@ -78,7 +95,7 @@ int System::createDirectory(const std::string &path) {
         return 2; // file exists
     }
 
-    auto inode = this->fileSystem->createInode();
+    auto inode = this->fileSystem->createInode(parent->getSelf()->inode->node_id);
     inode->inode->isDirectory = true;
     inode->inode->references = 2;
     auto stream = inode->getOutputStream(this->fileSystem);
@@ -116,7 +133,7 @@ int System::removeDirectory(const std::string &path) {
         return 1; // not found
     }
 
-    if (directory->getItems().size() > 2) {
+    if (directory->itemCount() > 2) {
         std::cerr << "NOT EMPTY" << std::endl;
         return 2; // not empty
     }
@@ -138,9 +155,10 @@ int System::removeDirectory(const std::string &path) {
     return 0;
 }
 
-int System::listDirectory(const std::string &path) {
+int System::listDirectory(const std::string &path, bool details) {
     int status = this->checkLoaded();
     if (status != 0) { return status; }
+    this->flushOpenFiles();
 
     std::string realPath = getRealPath(path);
     std::shared_ptr<Directory> directory = this->getDirectory(realPath, false);
@@ -150,9 +168,38 @@ int System::listDirectory(const std::string &path) {
         return 1;
     }
 
-    for (const directory_item& item : directory->getItems()) {
-        std::shared_ptr<INode> inode = this->fileSystem->getInode(item.inode);
-        std::cout << (inode->inode->isDirectory ? '-' : '+') << item.item_name << std::endl;
+    // streamed a cluster of entries at a time, each batch with one run of inode table reads
+    Directory::Iterator entries = directory->iterate();
+    size_t batchSize = this->fileSystem->clusterSize() / sizeof(directory_item);
+    std::vector<directory_item> items;
+    std::vector<int32_t> ids;
+    std::string output;
+    directory_item item{};
+    bool more = true;
+    while (more && std::cout.good()) {
+        items.clear();
+        ids.clear();
+        while (items.size() < batchSize && (more = entries.next(item))) {
+            items.push_back(item);
+            ids.push_back(item.inode);
+        }
+        std::vector<std::shared_ptr<INode>> inodes = this->fileSystem->getInodes(ids);
+
+        output.clear();
+        for (size_t i = 0; i < items.size(); ++i) {
+            std::shared_ptr<INode> inode = inodes[i];
+            if (inode == nullptr) {
+                continue;
+            }
+            output += inode->inode->isDirectory ? '-' : '+';
+            output += items[i].item_name;
+            if (details) {
+                output += " - " + std::to_string(inode->inode->file_size) + " - " + std::to_string(inode->inode->references)
+                          + " links - i-node " + std::to_string(inode->inode->node_id);
+            }
+            output += '\n';
+        }
+        std::cout << output << std::flush;
     }
 
     return 0;
@@ -211,6 +258,7 @@ int System::cd(const std::string &path) {
 int System::info(const std::string &path) {
     int status = this->checkLoaded();
     if (status != 0) { return status; }
+    this->flushOpenFiles();
 
     std::string realPath = getRealPath(path);
     std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
@@ -255,16 +303,26 @@ int System::copyFromOutside(const std::string &sourcePath, const std::string &pa
         return 3;
     }
 
-    std::shared_ptr<INode> fileInode = this->fileSystem->createInode();
+    // the size is known up front - reserve one run before copying
+    struct stat info{};
+    stat(sourcePath.c_str(), &info);
+    std::shared_ptr<INode> fileInode = this->fileSystem->createInode(directory->getSelf()->inode->node_id);
     fileInode->inode->references = 1;
-    auto output = fileInode->getOutputStream(this->fileSystem);
+    auto output = fileInode->open(this->fileSystem);
+    status = output->allocate(info.st_size, true);
+    if (status != 0) {
+        output->close();
+        this->fileSystem->removeInode(fileInode->inode);
+        std::cerr << (status == 1 ? "NOT ENOUGH SPACE" : "FILE TOO LARGE") << std::endl;
+        return 4;
+    }
     FILE * file = fopen(sourcePath.c_str(), "rb");
-    int r;
-    while((r = fgetc(file)) != EOF) {
-        char c = (char) r;
-        output.sputn(&c, 1);
+    std::vector<char> buffer(1 << 16);
+    size_t r;
+    while ((r = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        output->write(buffer.data(), r);
     }
-    output.close();
+    output->close();
     fclose(file);
 
     directory->addItem(filename, fileInode);
@@ -273,9 +331,104 @@ int System::copyFromOutside(const std::string &sourcePath, const std::string &pa
     return 0;
 }
 
+int System::importTree(const std::string &hostPath, const std::string &path) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::string realPath = getRealPath(path);
+    std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
+    if (directory == nullptr) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    std::string filename = realPath.substr(realPath.find_last_of('/') + 1);
+    if (directory->getItem(filename) != nullptr) {
+        std::cerr << "FILE EXISTS" << std::endl;
+        return 2;
+    }
+
+    Importer importer(this->fileSystem);
+    if (importer.scan(hostPath) != 0) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 3;
+    }
+    if ((int64_t) importer.entryCount() > this->fileSystem->freeInodes()
+        || importer.requiredClusters() > this->fileSystem->freeClusters()) {
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 4;
+    }
+
+    std::shared_ptr<INode> root = importer.import(directory->getSelf()->inode->node_id);
+    if (root == nullptr) {
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 4;
+    }
+    directory->addItem(filename, root);
+    if (!importer.isComplete()) {
+        // whatever fit is linked so the volume stays consistent
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 4;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::appendFile(const std::string &source, const std::string &path) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::string realPath = getRealPath(path);
+    std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
+
+    if (directory == nullptr) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    std::string filename = realPath.substr(realPath.find_last_of('/') + 1);
+    std::shared_ptr<INode> fileInode = directory->getItem(filename);
+    if (fileInode != nullptr && fileInode->inode->isDirectory) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 2;
+    }
+    if (fileInode != nullptr && this->inUse(fileInode)) {
+        return 3;
+    }
+    bool created = fileInode == nullptr;
+    if (created) {
+        fileInode = this->fileSystem->createInode(directory->getSelf()->inode->node_id);
+        fileInode->inode->references = 1;
+    }
+
+    // source is a host file when it exists, text otherwise
+    auto output = fileInode->getAppendStream(this->fileSystem);
+    if (access(source.c_str(), R_OK) == 0) {
+        FILE * file = fopen(source.c_str(), "rb");
+        std::vector<char> buffer(1 << 16);
+        size_t r;
+        while ((r = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+            output.sputn(buffer.data(), r);
+        }
+        fclose(file);
+    } else {
+        output.sputn(source.data(), source.size());
+    }
+    output.close();
+
+    if (created) {
+        directory->addItem(filename, fileInode);
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
 int System::copyToOutside(const std::string &outputPath, const std::string &path) {
     int status = this->checkLoaded();
     if (status != 0) { return status; }
+    this->flushOpenFiles();
 
     std::string realPath = getRealPath(path);
     std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
@@ -293,20 +446,275 @@ int System::copyToOutside(const std::string &outputPath, const std::string &path
     }
 
     FILE * outFile = fopen(outputPath.c_str(), "wb");
+    if (outFile == nullptr) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 4;
+    }
     auto input = file->getInputStream(this->fileSystem);
-    char item;
-    while (input.read(&item, sizeof(char)) != EOF) {
-        fputc(item, outFile);
+    std::vector<char> buffer(1 << 20);
+    int64_t r;
+    while ((r = input.readAvailable(buffer.data(), buffer.size())) > 0) {
+        fwrite(buffer.data(), 1, r, outFile);
     }
     fclose(outFile);
+    if (input.corrupted()) {
+        std::cerr << "CHECKSUM ERROR" << std::endl;
+        return 3;
+    }
 
     std::cout << "OK" << std::endl;
     return 0;
 }
 
+int System::copyToOutside(const std::vector<std::string> &sources, const std::string &hostPath) {
+    struct stat info{};
+    bool hostDirectory = stat(hostPath.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    if (sources.size() == 1 && sources[0].find_first_of("*?[") == std::string::npos && !hostDirectory) {
+        return this->copyToOutside(hostPath, sources[0]);
+    }
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+    if (sources.empty()) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 2;
+    }
+    if (!hostDirectory) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    // each file is copied by the pool, a name matched twice is copied once
+    std::set<std::string> targets;
+    std::atomic<int> failed(0);
+    std::atomic<int> corrupted(0);
+    ThreadPool pool;
+    for (const auto &match : this->expandPaths(sources, status)) {
+        const std::shared_ptr<INode> &file = match.second;
+        std::string target = hostPath + "/" + match.first;
+        if (file->inode->isDirectory || !targets.insert(target).second) {
+            continue;
+        }
+        pool.submit([this, file, target, &failed, &corrupted] {
+            FILE *outFile = fopen(target.c_str(), "wb");
+            if (outFile == nullptr) {
+                failed++;
+                return;
+            }
+            auto input = file->getInputStream(this->fileSystem);
+            std::vector<char> buffer(1 << 20);
+            int64_t r;
+            while ((r = input.readAvailable(buffer.data(), buffer.size())) > 0) {
+                fwrite(buffer.data(), 1, r, outFile);
+            }
+            fclose(outFile);
+            corrupted += input.corrupted() ? 1 : 0;
+        });
+    }
+    pool.wait();
+
+    if (failed > 0) {
+        std::cerr << "CANNOT CREATE FILE" << std::endl;
+        status = 3;
+    }
+    if (corrupted > 0) {
+        std::cerr << "CHECKSUM ERROR" << std::endl;
+        status = 4;
+    }
+    if (status == 0) {
+        std::cout << "OK" << std::endl;
+    }
+    return status;
+}
+
+std::vector<std::pair<std::string, std::shared_ptr<INode>>> System::expandPaths(const std::vector<std::string> &paths, int &status) {
+    // in argument order, every directory is loaded once and all inodes are fetched in one batch
+    std::map<std::string, std::shared_ptr<Directory>> directories;
+    std::vector<std::string> names;
+    std::vector<int32_t> ids;
+    for (const std::string &path : paths) {
+        std::string realPath = getRealPath(path);
+        size_t slash = realPath.find_last_of('/');
+        std::string parent = realPath.substr(0, slash + 1);
+        std::string pattern = realPath.substr(slash + 1);
+        auto cached = directories.find(parent);
+        if (cached == directories.end()) {
+            cached = directories.emplace(parent, this->getDirectory(parent, true)).first;
+        }
+        if (cached->second == nullptr) {
+            std::cerr << "PATH NOT FOUND" << std::endl;
+            status = 2;
+            continue;
+        }
+        size_t before = ids.size();
+        for (const directory_item &item : cached->second->getItems()) {
+            std::string name = item.item_name;
+            if (name != "." && name != ".." && fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+                names.push_back(name);
+                ids.push_back(item.inode);
+            }
+        }
+        if (ids.size() == before) {
+            std::cerr << "FILE NOT FOUND" << std::endl;
+            status = 2;
+        }
+    }
+
+    std::vector<std::pair<std::string, std::shared_ptr<INode>>> matches;
+    std::vector<std::shared_ptr<INode>> inodes = this->fileSystem->getInodes(ids);
+    for (size_t i = 0; i < inodes.size(); ++i) {
+        if (inodes[i] != nullptr) {
+            matches.emplace_back(names[i], inodes[i]);
+        }
+    }
+    return matches;
+}
+
+int System::printFiles(const std::vector<std::string> &paths) {
+    if (paths.size() == 1) {
+        return this->printFile(paths[0]);
+    }
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+    if (paths.empty()) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 2;
+    }
+
+    struct Content {
+        std::vector<char> data;
+        bool corrupted;
+    };
+    auto readWhole = [this](const std::shared_ptr<INode> &file) {
+        Content content{std::vector<char>((size_t) file->inode->file_size), false};
+        auto input = file->getInputStream(this->fileSystem);
+        int64_t done = 0;
+        int64_t r;
+        while (done < (int64_t) content.data.size() && (r = input.readAvailable(content.data.data() + done, content.data.size() - done)) > 0) {
+            done += r;
+        }
+        content.data.resize((size_t) done);
+        content.corrupted = input.corrupted();
+        return content;
+    };
+
+    // files are written in order while the next few small ones are already being read
+    std::vector<std::shared_ptr<INode>> files;
+    for (const std::string &path : paths) {
+        std::shared_ptr<INode> file = this->getPathInode(getRealPath(path));
+        files.push_back(file != nullptr && !file->inode->isDirectory ? file : nullptr);
+    }
+    std::vector<std::future<Content>> ahead(files.size());
+    size_t scheduled = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        for (; scheduled < files.size() && scheduled <= i + PREFETCH_FILES; ++scheduled) {
+            if (files[scheduled] != nullptr && files[scheduled]->inode->file_size <= PREFETCH_LIMIT) {
+                ahead[scheduled] = std::async(std::launch::async, readWhole, files[scheduled]);
+            }
+        }
+        if (files[i] == nullptr) {
+            std::cerr << "FILE NOT FOUND" << std::endl;
+            status = 2;
+            continue;
+        }
+
+        bool corrupted;
+        if (ahead[i].valid()) {
+            Content content = ahead[i].get();
+            std::cout.write(content.data.data(), (std::streamsize) content.data.size());
+            corrupted = content.corrupted;
+        } else {
+            auto input = files[i]->getInputStream(this->fileSystem);
+            std::vector<char> buffer(1 << 16);
+            int64_t r;
+            while ((r = input.readAvailable(buffer.data(), buffer.size())) > 0) {
+                std::cout.write(buffer.data(), r);
+            }
+            corrupted = input.corrupted();
+        }
+        std::cout << std::endl;
+        if (corrupted) {
+            std::cerr << "CHECKSUM ERROR" << std::endl;
+            status = 3;
+        }
+    }
+    return status;
+}
+
+int System::grep(const std::string &pattern, const std::string &path, bool recursive) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+    if (pattern.empty()) {
+        std::cerr << "INVALID PATTERN" << std::endl;
+        return 1;
+    }
+    std::string realPath = getRealPath(path.empty() ? "." : path);
+    std::shared_ptr<INode> root = this->getPathInode(realPath);
+    if (root == nullptr) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 2;
+    }
+
+    // a file, the files of a directory or the whole tree below it
+    std::vector<std::pair<std::string, std::shared_ptr<INode>>> files;
+    if (!root->inode->isDirectory) {
+        files.emplace_back(realPath, root);
+    } else if (recursive) {
+        std::set<int32_t> visited;
+        this->walkTree(realPath, root, visited, [&files](const std::string &itemPath, const std::shared_ptr<INode> &inode) {
+            if (!inode->inode->isDirectory) {
+                files.emplace_back(itemPath, inode);
+            }
+        });
+    } else {
+        Directory directory(root, this->fileSystem);
+        Directory::Iterator entries = directory.iterate();
+        std::vector<std::string> names;
+        std::vector<int32_t> ids;
+        directory_item item{};
+        while (entries.next(item)) {
+            names.emplace_back(item.item_name);
+            ids.push_back(item.inode);
+        }
+        std::vector<std::shared_ptr<INode>> inodes = this->fileSystem->getInodes(ids);
+        for (size_t i = 0; i < inodes.size(); ++i) {
+            if (inodes[i] != nullptr && !inodes[i]->inode->isDirectory) {
+                files.emplace_back(realPath == "/" ? "/" + names[i] : realPath + "/" + names[i], inodes[i]);
+            }
+        }
+    }
+
+    // files are searched in parallel, matches are printed in the order of the files
+    std::vector<std::vector<int64_t>> matches(files.size());
+    std::atomic<int> corrupted(0);
+    ThreadPool pool;
+    for (size_t i = 0; i < files.size(); ++i) {
+        pool.submit([this, &files, &matches, &pattern, &corrupted, i] {
+            corrupted += Searcher::searchFile(files[i].second, this->fileSystem, pattern, matches[i]);
+        });
+    }
+    pool.wait();
+
+    std::string output;
+    for (size_t i = 0; i < files.size(); ++i) {
+        for (int64_t offset : matches[i]) {
+            output += files[i].first + ":" + std::to_string(offset) + '\n';
+        }
+    }
+    std::cout << output << std::flush;
+    if (corrupted > 0) {
+        std::cerr << "CHECKSUM ERROR" << std::endl;
+        return 3;
+    }
+    return 0;
+}
+
 int System::printFile(const std::string &path) {
     int status = this->checkLoaded();
     if (status != 0) { return status; }
+    this->flushOpenFiles();
 
     std::string realPath = getRealPath(path);
     std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
@@ -324,17 +732,23 @@ int System::printFile(const std::string &path) {
     }
 
     auto input = file->getInputStream(this->fileSystem);
-    char item;
-    while (input.read(&item, sizeof(char)) != EOF) {
-        std::cout << item;
+    std::vector<char> buffer(1 << 16);
+    int64_t r;
+    while ((r = input.readAvailable(buffer.data(), buffer.size())) > 0) {
+        std::cout.write(buffer.data(), r);
     }
     std::cout << std::endl;
+    if (input.corrupted()) {
+        std::cerr << "CHECKSUM ERROR" << std::endl;
+        return 3;
+    }
     return 0;
 }
 
 int System::copyFile(const std::string &from, const std::string &to) {
     int status = this->checkLoaded();
     if (status != 0) { return status; }
+    this->flushOpenFiles();
 
     std::string fromPath = getRealPath(from);
     std::shared_ptr<Directory> fromDirectory = this->getDirectory(fromPath, true);
@@ -365,15 +779,13 @@ int System::copyFile(const std::string &from, const std::string &to) {
         return 3;
     }
 
-    auto input = inputFile->getInputStream(this->fileSystem);
-    std::shared_ptr<INode> fileInode = this->fileSystem->createInode();
+    std::shared_ptr<INode> fileInode = this->fileSystem->createInode(toDirectory->getSelf()->inode->node_id);
     fileInode->inode->references = 1;
-    auto output = fileInode->getOutputStream(this->fileSystem);
-    char item;
-    while (input.read(&item, sizeof(char)) != EOF) {
-        output.sputn(&item, 1);
+    if (inputFile->copyTo(this->fileSystem, fileInode) != 0) {
+        this->fileSystem->removeInode(fileInode->inode);
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 4;
     }
-    output.close();
     toDirectory->addItem(toFilename, fileInode);
 
     std::cout << "OK" << std::endl;
@@ -439,6 +851,9 @@ int System::removeFile(const std::string &from) {
         std::cerr << "FILE NOT FOUND" << std::endl;
         return 2;
     }
+    if (this->inUse(inputFile)) {
+        return 3;
+    }
 
     fromDirectory->removeItem(fromFilename);
     inputFile->inode->references--;
@@ -485,6 +900,9 @@ int System::hardLink(const std::string &from, const std::string &to) {
         std::cerr << "FILE EXISTS" << std::endl;
         return 3;
     }
+    if (this->inUse(inputFile)) {
+        return 4;
+    }
 
     toDirectory->addItem(toFilename, inputFile);
     inputFile->inode->references++;
@@ -494,11 +912,807 @@ int System::hardLink(const std::string &from, const std::string &to) {
     return 0;
 }
 
-int System::format(unsigned long size) {
-    this->fileSystem->format(size);
+int System::format(uint64_t size, int32_t clusterSize, int32_t stripeUnit) {
+    if (this->scrubber != nullptr) {
+        this->scrubber->stop();
+    }
+    int status = this->fileSystem->format(size, clusterSize, stripeUnit);
+    if (status == 3) {
+        std::cerr << "INVALID STRIPE UNIT" << std::endl;
+        return 1;
+    } else if (status != 0) {
+        std::cerr << "INVALID CLUSTER SIZE" << std::endl;
+        return 1;
+    }
+    // handles and queued work refer to the old image
+    this->handles.clear();
+    this->openFiles.clear();
+    this->defragPath.clear();
+    this->defragQueue.clear();
     this->fileSystem->load();
     this->loaded = true;
 
     std::cout << "OK" << std::endl;
     return 0;
 }
+
+int System::grow(uint64_t size) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    // the scrubber walks the groups being extended
+    if (this->scrubber != nullptr) {
+        this->scrubber->stop();
+    }
+    status = this->fileSystem->grow(size);
+    if (status == 1) {
+        std::cerr << "GROW NOT SUPPORTED" << std::endl;
+        return 1;
+    } else if (status == 2) {
+        std::cerr << "INVALID SIZE" << std::endl;
+        return 2;
+    } else if (status == 3) {
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 3;
+    }
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::diskFree() {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    // counters kept by the allocator - nothing is scanned
+    int64_t clusterSize = this->fileSystem->clusterSize();
+    int64_t total = this->fileSystem->clusterCount();
+    int64_t used = this->fileSystem->usedClusters();
+    int64_t free = this->fileSystem->freeClusters();
+    std::cout << "CAPACITY " << total * clusterSize << " - USED " << used * clusterSize << " - FREE " << free * clusterSize << std::endl;
+    std::cout << "CLUSTERS " << total << " - USED " << used << " - FREE " << free << std::endl;
+    std::cout << "INODES " << this->fileSystem->inodeCount() << " - USED " << this->fileSystem->usedInodes()
+              << " - FREE " << this->fileSystem->freeInodes() << std::endl;
+    if (this->fileSystem->stripeCount() > 1) {
+        std::cout << "MEMBERS " << this->fileSystem->stripeCount() << " - STRIPE UNIT " << this->fileSystem->stripeUnit() << std::endl;
+    }
+    return 0;
+}
+
+int System::scrub(const std::string &action) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    if (!this->fileSystem->checksums()) {
+        std::cerr << "CHECKSUMS NOT ENABLED" << std::endl;
+        return 1;
+    }
+    if (action == "stop") {
+        if (this->scrubber != nullptr) {
+            this->scrubber->stop();
+        }
+        std::cout << "OK" << std::endl;
+        return 0;
+    }
+    if (action == "status") {
+        if (this->scrubber == nullptr) {
+            std::cout << "SCRUB NOT STARTED" << std::endl;
+            return 0;
+        }
+        std::vector<int64_t> errors = this->scrubber->errors();
+        std::cout << "SCRUB " << (this->scrubber->running() ? "RUNNING" : "DONE") << " - CHECKED " << this->scrubber->checked()
+                  << " / " << this->scrubber->total() << " - ERRORS " << errors.size() << std::endl;
+        for (int64_t address : errors) {
+            std::cout << "CHECKSUM ERROR " << address << std::endl;
+        }
+        return 0;
+    }
+
+    // rate in MB/s, runs in the background until done or stopped
+    int64_t rate = action.empty() ? 64 : std::stoll(action);
+    if (this->scrubber == nullptr) {
+        this->scrubber = std::make_shared<Scrubber>(this->fileSystem);
+    }
+    this->scrubber->start(rate << 20);
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::discard(const std::string &mode) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    if (mode.empty()) {
+        std::cout << "DISCARD " << (this->fileSystem->discard() ? "ON" : "OFF") << std::endl;
+        return 0;
+    }
+    if (mode != "on" && mode != "off") {
+        std::cerr << "INVALID MODE" << std::endl;
+        return 1;
+    }
+    if (!this->fileSystem->setDiscard(mode == "on")) {
+        std::cerr << "DISCARD NOT SUPPORTED" << std::endl;
+        return 2;
+    }
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::trim() {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    int64_t trimmed = this->fileSystem->trim();
+    if (trimmed < 0) {
+        std::cerr << "DISCARD NOT SUPPORTED" << std::endl;
+        return 1;
+    }
+    std::cout << "TRIMMED " << trimmed << " CLUSTERS" << std::endl;
+    return 0;
+}
+
+int System::preallocate(const std::string &path, int64_t size) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::string realPath = getRealPath(path);
+    std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
+    if (directory == nullptr) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    std::string filename = realPath.substr(realPath.find_last_of('/') + 1);
+    std::shared_ptr<INode> fileInode = directory->getItem(filename);
+    if (fileInode != nullptr && fileInode->inode->isDirectory) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 2;
+    }
+    if (fileInode != nullptr && this->inUse(fileInode)) {
+        return 4;
+    }
+    bool created = fileInode == nullptr;
+    if (created) {
+        fileInode = this->fileSystem->createInode(directory->getSelf()->inode->node_id);
+        fileInode->inode->references = 1;
+    }
+
+    status = fileInode->allocate(this->fileSystem, size);
+    if (status != 0) {
+        if (created) {
+            this->fileSystem->removeInode(fileInode->inode);
+        }
+        std::cerr << (status == 1 ? "NOT ENOUGH SPACE" : "FILE TOO LARGE") << std::endl;
+        return 3;
+    }
+    if (created) {
+        directory->addItem(filename, fileInode);
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::exportImage(const std::string &hostFile, bool compress) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+
+    if (Archive(this->fileSystem).save(hostFile, compress) != 0) {
+        std::cerr << "CANNOT WRITE FILE" << std::endl;
+        return 1;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::importImage(const std::string &hostFile) {
+    if (access(hostFile.c_str(), R_OK) != 0) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    if (this->scrubber != nullptr) {
+        this->scrubber->stop();
+    }
+    int status = Archive(this->fileSystem).restore(hostFile);
+    if (status == 1 || status == 2) {
+        std::cerr << "INVALID ARCHIVE" << std::endl;
+        return 2;
+    }
+    this->handles.clear();
+    this->openFiles.clear();
+    this->defragPath.clear();
+    this->defragQueue.clear();
+    this->pwd = "/";
+    if (status != 0) {
+        // the old image is already overwritten
+        this->loaded = false;
+        std::cerr << "INVALID ARCHIVE" << std::endl;
+        return 3;
+    }
+    if (this->fileSystem->load() != 0) {
+        this->loaded = false;
+        std::cerr << "INVALID VOLUME" << std::endl;
+        return 4;
+    }
+    this->loaded = true;
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+std::shared_ptr<INode> System::getPathInode(const std::string &realPath) {
+    std::shared_ptr<Directory> directory = this->getDirectory(realPath, true);
+    if (directory == nullptr) {
+        return nullptr;
+    }
+    if (realPath == "/") {
+        return directory->getSelf();
+    }
+    std::string filename = realPath.substr(realPath.find_last_of('/') + 1);
+    return directory->getItem(filename);
+}
+
+void System::walkTree(const std::string &path, const std::shared_ptr<INode> &inode, std::set<int32_t> &visited,
+                      const std::function<void(const std::string &, const std::shared_ptr<INode> &)> &callback) {
+    if (!visited.insert(inode->inode->node_id).second) {
+        return;
+    }
+    callback(path, inode);
+    if (!inode->inode->isDirectory) {
+        return;
+    }
+
+    Directory directory(inode, this->fileSystem);
+    for (const directory_item &item : directory.getItems()) {
+        std::string name = item.item_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::shared_ptr<INode> child = this->fileSystem->getInode(item.inode);
+        if (child != nullptr) {
+            this->walkTree(path == "/" ? "/" + name : path + "/" + name, child, visited, callback);
+        }
+    }
+}
+
+int System::fragmentation(const std::string &path) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::string realPath = getRealPath(path.empty() ? "/" : path);
+    std::shared_ptr<INode> root = this->getPathInode(realPath);
+    if (root == nullptr) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    int64_t clusterSize = this->fileSystem->clusterSize();
+    int64_t files = 0;
+    int64_t fragmented = 0;
+    int64_t extents = 0;
+    std::set<int32_t> visited;
+    this->walkTree(realPath, root, visited, [&](const std::string &itemPath, const std::shared_ptr<INode> &inode) {
+        std::vector<int64_t> data;
+        std::vector<int64_t> links;
+        inode->blockMap(this->fileSystem, data, links);
+        if (data.empty()) {
+            return;
+        }
+        int64_t fileExtents = 1;
+        for (size_t i = 1; i < data.size(); ++i) {
+            fileExtents += data[i] == data[i - 1] + clusterSize ? 0 : 1;
+        }
+        files++;
+        extents += fileExtents;
+        fragmented += fileExtents > 1 ? 1 : 0;
+        std::cout << itemPath << " - " << data.size() << " clusters - " << fileExtents << " extents" << std::endl;
+    });
+
+    std::cout << "FILES " << files << " - FRAGMENTED " << fragmented << " - EXTENTS " << extents
+              << " - FREE " << this->fileSystem->freeClusters() << " - LARGEST FREE RUN " << this->fileSystem->largestFreeRun() << std::endl;
+    return 0;
+}
+
+int System::defragment(const std::string &path, int64_t budget) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::string realPath = getRealPath(path.empty() ? "/" : path);
+    if (this->defragQueue.empty() || this->defragPath != realPath) {
+        std::shared_ptr<INode> root = this->getPathInode(realPath);
+        if (root == nullptr) {
+            std::cerr << "FILE NOT FOUND" << std::endl;
+            return 1;
+        }
+        this->defragPath = realPath;
+        this->defragQueue.clear();
+        std::set<int32_t> visited;
+        this->walkTree(realPath, root, visited, [&](const std::string &, const std::shared_ptr<INode> &inode) {
+            this->defragQueue.push_back(inode->inode->node_id);
+        });
+    }
+
+    // budget in milliseconds - the rest of the queue is kept for the next call
+    auto start = std::chrono::steady_clock::now();
+    int64_t moved = 0;
+    while (!this->defragQueue.empty()) {
+        std::shared_ptr<INode> inode = this->fileSystem->getInode(this->defragQueue.front());
+        this->defragQueue.pop_front();
+        // open files are left where they are
+        if (inode != nullptr && this->openFiles.count(inode->inode->node_id) == 0 && inode->relocate(this->fileSystem)) {
+            moved++;
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        if (budget > 0 && elapsed.count() >= budget) {
+            break;
+        }
+    }
+
+    if (!this->defragQueue.empty()) {
+        std::cout << "MOVED " << moved << " - " << this->defragQueue.size() << " LEFT" << std::endl;
+        return 0;
+    }
+    std::cout << "MOVED " << moved << std::endl;
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::check(bool repair) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+
+    Checker checker(this->fileSystem);
+    status = checker.check(repair);
+    if (status == 0) {
+        std::cout << "OK" << std::endl;
+    }
+    return status;
+}
+
+int System::openFile(const std::string &path) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::shared_ptr<INode> file = this->getPathInode(getRealPath(path));
+    if (file == nullptr || file->inode->isDirectory) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    int32_t handle = this->nextHandle++;
+    OpenFile &openFile = this->openFiles[file->inode->node_id];
+    if (openFile.file == nullptr) {
+        openFile.file = file->open(this->fileSystem);
+    }
+    openFile.handles++;
+    this->handles[handle] = Handle{file->inode->node_id, 0};
+    std::cout << "HANDLE " << handle << std::endl;
+    return 0;
+}
+
+std::shared_ptr<MemoryIterator> System::getOpenFile(int32_t handle) {
+    auto it = this->handles.find(handle);
+    if (it == this->handles.end()) {
+        std::cerr << "INVALID HANDLE" << std::endl;
+        return nullptr;
+    }
+    std::shared_ptr<MemoryIterator> file = this->openFiles[it->second.node].file;
+    file->seek(it->second.position);
+    return file;
+}
+
+bool System::inUse(const std::shared_ptr<INode> &inode) {
+    // the open iterator owns the block map until the last handle is closed
+    if (this->openFiles.count(inode->inode->node_id) == 0) {
+        return false;
+    }
+    std::cerr << "FILE IN USE" << std::endl;
+    return true;
+}
+
+int System::flushFile(int32_t handle) {
+    std::shared_ptr<MemoryIterator> file = this->getOpenFile(handle);
+    if (file == nullptr) {
+        return 1;
+    }
+    if (file->flush() != 0) {
+        file->noSpace = false;
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 2;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+void System::flushOpenFiles() {
+    // data written through handles is made visible to commands working with paths
+    for (auto &file : this->openFiles) {
+        file.second.file->flush();
+    }
+}
+
+int System::closeFile(int32_t handle) {
+    std::shared_ptr<MemoryIterator> file = this->getOpenFile(handle);
+    if (file == nullptr) {
+        return 1;
+    }
+    int32_t node = this->handles[handle].node;
+    this->handles.erase(handle);
+    if (--this->openFiles[node].handles == 0) {
+        this->openFiles.erase(node);
+        if (file->close() != 0) {
+            std::cerr << "NOT ENOUGH SPACE" << std::endl;
+            return 2;
+        }
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::seekFile(int32_t handle, int64_t offset) {
+    std::shared_ptr<MemoryIterator> file = this->getOpenFile(handle);
+    if (file == nullptr) {
+        return 1;
+    }
+    file->seek(offset);
+    this->handles[handle].position = file->tell();
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::readFile(int32_t handle, int64_t offset, int64_t length) {
+    // offset -1 reads from the current position
+    std::shared_ptr<MemoryIterator> file = this->getOpenFile(handle);
+    if (file == nullptr) {
+        return 1;
+    }
+    if (length < 0) {
+        std::cerr << "INVALID LENGTH" << std::endl;
+        return 2;
+    }
+    if (offset >= 0) {
+        file->seek(offset);
+    }
+    // never more than the rest of the file
+    length = std::min(length, std::max<int64_t>(file->size() - file->tell(), 0));
+    std::vector<char> buffer(length);
+    int64_t done = file->read(buffer.data(), length);
+    if (offset < 0) {
+        this->handles[handle].position = file->tell();
+    }
+
+    std::cout.write(buffer.data(), done);
+    std::cout << std::endl;
+    return 0;
+}
+
+int System::writeFile(int32_t handle, int64_t offset, const std::string &data) {
+    // offset -1 writes at the current position
+    std::shared_ptr<MemoryIterator> file = this->getOpenFile(handle);
+    if (file == nullptr) {
+        return 1;
+    }
+    if (offset >= 0) {
+        file->seek(offset);
+    }
+    int64_t done = file->write(data.data(), data.size());
+    if (offset < 0) {
+        this->handles[handle].position = file->tell();
+    }
+    if (file->noSpace) {
+        // buffered data is allocated in batches - the failure may come from an earlier write
+        file->noSpace = false;
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 3;
+    }
+    if (done < (int64_t) data.size()) {
+        std::cerr << "FILE TOO LARGE" << std::endl;
+        return 2;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::truncateFile(int32_t handle, int64_t size) {
+    std::shared_ptr<MemoryIterator> file = this->getOpenFile(handle);
+    if (file == nullptr) {
+        return 1;
+    }
+    if (size < 0 || size > this->fileSystem->maxFileSize()) {
+        std::cerr << "INVALID SIZE" << std::endl;
+        return 2;
+    }
+    file->resize(size);
+    if (file->noSpace) {
+        file->noSpace = false;
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 3;
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::copyTree(const std::string &from, const std::string &to) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+
+    std::string fromPath = getRealPath(from);
+    std::shared_ptr<INode> source = this->getPathInode(fromPath);
+    if (source == nullptr) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+    if (!source->inode->isDirectory) {
+        return this->copyFile(from, to);
+    }
+
+    std::string toPath = getRealPath(to);
+    std::shared_ptr<Directory> toDirectory = this->getDirectory(toPath, true);
+    if (toDirectory == nullptr) {
+        std::cerr << "PATH NOT FOUND" << std::endl;
+        return 1;
+    }
+    std::string toFilename = toPath.substr(toPath.find_last_of('/') + 1);
+    if (toDirectory->getItem(toFilename) != nullptr) {
+        std::cerr << "FILE EXISTS" << std::endl;
+        return 3;
+    }
+    if (fromPath == "/" || toPath.compare(0, fromPath.size() + 1, fromPath + "/") == 0) {
+        std::cerr << "INVALID TARGET" << std::endl;
+        return 4;
+    }
+
+    // the whole tree has to fit before anything is created
+    std::mutex mutex;
+    int64_t requiredInodes = 1;
+    int64_t requiredClusters = 0;
+    TreeWalker counter(this->fileSystem);
+    counter.walk(TreeWalker::Node{fromPath, source}, [&](const TreeWalker::Node &, const std::vector<TreeWalker::Node> &children) {
+        int64_t clusters = this->fileSystem->fileClusterCount((int64_t) ((children.size() + 2) * sizeof(directory_item)));
+        for (const TreeWalker::Node &child : children) {
+            if (!child.inode->inode->isDirectory) {
+                clusters += this->fileSystem->fileClusterCount(child.inode->inode->file_size);
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        requiredInodes += (int64_t) children.size();
+        requiredClusters += clusters;
+    });
+    if (requiredInodes > this->fileSystem->freeInodes() || requiredClusters > this->fileSystem->freeClusters()) {
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 5;
+    }
+
+    // source directory id -> copy of the directory and its parent
+    std::map<int32_t, std::pair<std::shared_ptr<INode>, int32_t>> targets;
+    std::shared_ptr<INode> root = this->fileSystem->createInode(toDirectory->getSelf()->inode->node_id);
+    if (root == nullptr) {
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 5;
+    }
+    root->inode->isDirectory = true;
+    std::vector<std::shared_ptr<INode>> copies{root};
+    std::atomic<bool> failed(false);
+    targets[source->inode->node_id] = std::make_pair(root, toDirectory->getSelf()->inode->node_id);
+
+    TreeWalker walker(this->fileSystem);
+    walker.walk(TreeWalker::Node{fromPath, source}, [&](const TreeWalker::Node &directory, const std::vector<TreeWalker::Node> &children) {
+        std::pair<std::shared_ptr<INode>, int32_t> target;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            target = targets[directory.inode->inode->node_id];
+        }
+        std::shared_ptr<INode> copy = target.first;
+        if (copy == nullptr) {
+            // its own inode could not be created
+            return;
+        }
+
+        std::vector<directory_item> items(2);
+        items[0].inode = copy->inode->node_id;
+        strcpy(items[0].item_name, ".");
+        items[1].inode = target.second;
+        strcpy(items[1].item_name, "..");
+
+        // one run for the files of the directory, reserved before their copies start
+        int64_t total = 0;
+        for (const TreeWalker::Node &child : children) {
+            if (!child.inode->inode->isDirectory) {
+                total += this->fileSystem->fileClusterCount(child.inode->inode->file_size);
+            }
+        }
+        int64_t start = total > 0 ? this->fileSystem->findFreeRun(total, this->fileSystem->inodeGoal(copy->inode->node_id)) : -1;
+        bool batched = start != -1 && this->fileSystem->allocateRun(start, total);
+        int64_t end = batched ? start + (total << this->fileSystem->clusterShift()) : start;
+
+        int8_t subdirectories = 0;
+        for (const TreeWalker::Node &child : children) {
+            std::shared_ptr<INode> childCopy = this->fileSystem->createInode(copy->inode->node_id);
+            if (childCopy == nullptr) {
+                failed = true;
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                copies.push_back(childCopy);
+            }
+            if (child.inode->inode->isDirectory) {
+                childCopy->inode->isDirectory = true;
+                subdirectories++;
+                std::lock_guard<std::mutex> lock(mutex);
+                targets[child.inode->inode->node_id] = std::make_pair(childCopy, copy->inode->node_id);
+            } else {
+                childCopy->inode->references = 1;
+                std::shared_ptr<INode> original = child.inode;
+                int64_t run = -1;
+                int64_t clusters = this->fileSystem->fileClusterCount(original->inode->file_size);
+                if (batched && clusters > 0) {
+                    run = start;
+                    start += clusters << this->fileSystem->clusterShift();
+                }
+                walker.getPool().submit([this, original, childCopy, run, &failed] {
+                    if (original->copyTo(this->fileSystem, childCopy, run) != 0) {
+                        failed = true;
+                    }
+                });
+            }
+            directory_item item{};
+            item.inode = childCopy->inode->node_id;
+            strcpy(item.item_name, child.path.substr(child.path.find_last_of('/') + 1, 11).c_str());
+            items.push_back(item);
+        }
+        // clusters of files that got no inode
+        for (; start < end; start += this->fileSystem->clusterSize()) {
+            this->fileSystem->removeClusterByAddress(start);
+        }
+
+        // the directory is written exactly once
+        copy->inode->references = (int8_t) (2 + subdirectories);
+        auto output = copy->getOutputStream(this->fileSystem);
+        output.sputn(reinterpret_cast<const char *>(items.data()), items.size() * sizeof(directory_item));
+        output.close();
+    });
+
+    // the copy is not linked yet - a partial tree is simply released
+    if (failed) {
+        for (const std::shared_ptr<INode> &copy : copies) {
+            walker.getPool().submit([this, copy] {
+                copy->truncate(this->fileSystem);
+                this->fileSystem->removeInode(copy->inode);
+            });
+        }
+        walker.getPool().wait();
+        std::cerr << "NOT ENOUGH SPACE" << std::endl;
+        return 5;
+    }
+    toDirectory->addItem(toFilename, root);
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::removeTree(const std::string &path) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+
+    std::string realPath = getRealPath(path);
+    std::shared_ptr<INode> root = this->getPathInode(realPath);
+    if (root == nullptr) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+    if (!root->inode->isDirectory) {
+        return this->removeFile(path);
+    }
+    std::string dirname = realPath.substr(realPath.find_last_of('/') + 1);
+    if (realPath == "/" || dirname == "." || dirname == "..") {
+        return 3;
+    }
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<INode>> directories;
+    std::map<int32_t, std::pair<std::shared_ptr<INode>, int8_t>> files;
+    TreeWalker walker(this->fileSystem);
+    walker.walk(TreeWalker::Node{realPath, root}, [&](const TreeWalker::Node &directory, const std::vector<TreeWalker::Node> &children) {
+        std::lock_guard<std::mutex> lock(mutex);
+        directories.push_back(directory.inode);
+        for (const TreeWalker::Node &child : children) {
+            if (!child.inode->inode->isDirectory) {
+                auto &file = files[child.inode->inode->node_id];
+                file.first = child.inode;
+                file.second++;
+            }
+        }
+    });
+
+    for (auto &file : files) {
+        if (this->inUse(file.second.first)) {
+            return 4;
+        }
+    }
+
+    // hard links from outside the tree keep their file alive
+    for (auto &file : files) {
+        std::shared_ptr<INode> inode = file.second.first;
+        int8_t links = file.second.second;
+        walker.getPool().submit([this, inode, links] {
+            inode->inode->references -= links;
+            if (inode->inode->references <= 0) {
+                inode->truncate(this->fileSystem);
+                this->fileSystem->removeInode(inode->inode);
+            } else {
+                this->fileSystem->saveInode(inode->inode.get());
+            }
+        });
+    }
+    for (const std::shared_ptr<INode> &directory : directories) {
+        walker.getPool().submit([this, directory] {
+            directory->truncate(this->fileSystem);
+            this->fileSystem->removeInode(directory->inode);
+        });
+    }
+    walker.getPool().wait();
+
+    this->getDirectory(realPath, true)->removeItem(dirname, true);
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
+
+int System::diskUsage(const std::string &path) {
+    int status = this->checkLoaded();
+    if (status != 0) { return status; }
+    this->flushOpenFiles();
+
+    std::string realPath = getRealPath(path.empty() ? "/" : path);
+    std::shared_ptr<INode> root = this->getPathInode(realPath);
+    if (root == nullptr) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+
+    std::mutex mutex;
+    std::set<int32_t> counted;
+    int64_t size = 0;
+    int64_t clusters = 0;
+    auto count = [&](const std::shared_ptr<INode> &inode) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!counted.insert(inode->inode->node_id).second) {
+                return;
+            }
+        }
+        std::vector<int64_t> data;
+        std::vector<int64_t> links;
+        inode->blockMap(this->fileSystem, data, links);
+        std::lock_guard<std::mutex> lock(mutex);
+        size += inode->inode->file_size;
+        clusters += (int64_t) (data.size() + links.size());
+    };
+
+    if (root->inode->isDirectory) {
+        TreeWalker walker(this->fileSystem);
+        walker.walk(TreeWalker::Node{realPath, root}, [&](const TreeWalker::Node &directory, const std::vector<TreeWalker::Node> &children) {
+            count(directory.inode);
+            for (const TreeWalker::Node &child : children) {
+                if (!child.inode->inode->isDirectory) {
+                    count(child.inode);
+                }
+            }
+        });
+    } else {
+        count(root);
+    }
+
+    std::cout << realPath << " - " << size << " - " << clusters << " clusters" << std::endl;
+    return 0;
+}
@@ -1,34 +1,89 @@
 #pragma once
 #include <memory>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
 #include "FileSystem.hpp"
 #include "Directory.hpp"
+#include "Scrubber.hpp"
 
 class System {
 public:
     explicit System(const std::string& file);
+    ~System();
     int checkLoaded();
     int createDirectory(const std::string& path);
     int removeDirectory(const std::string& path);
-    int listDirectory(const std::string& path);
+    int listDirectory(const std::string& path, bool details = false);
     int printPwd();
     int cd(const std::string& path);
     int info(const std::string& path);
     int copyFromOutside(const std::string& sourcePath, const std::string& path);
+    int importTree(const std::string& hostPath, const std::string& path);
+    int appendFile(const std::string& source, const std::string& path);
     int copyToOutside(const std::string& outputPath, const std::string& path);
+    int copyToOutside(const std::vector<std::string>& sources, const std::string& hostPath);
     int printFile(const std::string& path);
+    int printFiles(const std::vector<std::string>& paths);
+    int grep(const std::string& pattern, const std::string& path, bool recursive);
     int copyFile(const std::string& from, const std::string& to);
+    int copyTree(const std::string& from, const std::string& to);
+    int removeTree(const std::string& path);
+    int diskUsage(const std::string& path);
+    int diskFree();
+    int grow(uint64_t size);
+    int scrub(const std::string& action);
+    int discard(const std::string& mode);
+    int trim();
     int moveFile(const std::string& from, const std::string& to);
     int removeFile(const std::string& from);
     int hardLink(const std::string& from, const std::string& to);
-    int format(unsigned long size);
+    int fragmentation(const std::string& path);
+    int defragment(const std::string& path, int64_t budget);
+    int check(bool repair);
+    int openFile(const std::string& path);
+    int closeFile(int32_t handle);
+    int flushFile(int32_t handle);
+    int seekFile(int32_t handle, int64_t offset);
+    int readFile(int32_t handle, int64_t offset, int64_t length);
+    int writeFile(int32_t handle, int64_t offset, const std::string& data);
+    int truncateFile(int32_t handle, int64_t size);
+    int format(uint64_t size, int32_t clusterSize = CLUSTER_SIZE, int32_t stripeUnit = STRIPE_UNIT);
+    int preallocate(const std::string& path, int64_t size);
+    int exportImage(const std::string& hostFile, bool compress);
+    int importImage(const std::string& hostFile);
     std::string pwd;
 
 protected:
+    // handles of one file share its iterator, each keeps its own position
+    struct OpenFile {
+        std::shared_ptr<MemoryIterator> file;
+        int32_t handles;
+    };
+    struct Handle {
+        int32_t node;
+        int64_t position;
+    };
+
     std::shared_ptr<FileSystem> fileSystem;
     bool loaded;
+    std::string defragPath;
+    std::deque<int32_t> defragQueue;
+    std::map<int32_t, Handle> handles;
+    std::map<int32_t, OpenFile> openFiles;
+    int32_t nextHandle = 1;
+    std::shared_ptr<Scrubber> scrubber;
 
     std::string getRealPath(const std::string &path);
     std::shared_ptr<Directory> getDirectory(const std::string& path, bool ignoreLast = false);
+    std::shared_ptr<INode> getPathInode(const std::string& realPath);
+    std::vector<std::pair<std::string, std::shared_ptr<INode>>> expandPaths(const std::vector<std::string>& paths, int& status);
+    std::shared_ptr<MemoryIterator> getOpenFile(int32_t handle);
+    bool inUse(const std::shared_ptr<INode>& inode);
+    void flushOpenFiles();
+    void walkTree(const std::string& path, const std::shared_ptr<INode>& inode, std::set<int32_t>& visited,
+                  const std::function<void(const std::string&, const std::shared_ptr<INode>&)>& callback);
 };
 
 
@@ -0,0 +1,63 @@
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(size_t threads) {
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        this->workers.emplace_back(&ThreadPool::work, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->available.notify_all();
+    for (std::thread &worker : this->workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push(std::move(task));
+    }
+    this->available.notify_one();
+}
+
+void ThreadPool::wait() {
+    // tasks may submit further tasks, wait until nothing is queued or running
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->finished.wait(lock, [this] { return this->tasks.empty() && this->running == 0; });
+}
+
+size_t ThreadPool::size() const {
+    return this->workers.size();
+}
+
+void ThreadPool::work() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->available.wait(lock, [this] { return this->stopping || !this->tasks.empty(); });
+            if (this->tasks.empty()) {
+                return;
+            }
+            task = std::move(this->tasks.front());
+            this->tasks.pop();
+            this->running++;
+        }
+        task();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->running--;
+            if (this->tasks.empty() && this->running == 0) {
+                this->finished.notify_all();
+            }
+        }
+    }
+}
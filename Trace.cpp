@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "Trace.hpp"
+#include "Console.hpp"
+
+// output of replayed commands goes nowhere
+class DiscardBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+int Trace::start(const std::string& file) {
+    this->stop();
+    this->output.open(file, std::ios::trunc);
+    if (!this->output.is_open()) {
+        return 1;
+    }
+    this->output << "# time_us\tbytes\tcommand" << std::endl;
+    this->started = std::chrono::steady_clock::now();
+    return 0;
+}
+
+void Trace::stop() {
+    if (this->output.is_open()) {
+        this->output.close();
+    }
+}
+
+bool Trace::recording() const {
+    return this->output.is_open();
+}
+
+void Trace::record(const std::string& line) {
+    // microseconds since the recording started, bytes the command carries, the command itself
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - this->started).count();
+    this->output << time << '\t' << argumentSize(line) << '\t' << line << '\n';
+    this->output.flush();
+}
+
+int64_t Trace::argumentSize(const std::string& line) {
+    // data written by the command - host files by their size, inline text by its length
+    std::vector<std::string> args = Console::split(line, 4);
+    if (args.empty()) {
+        return 0;
+    }
+    struct stat info{};
+    if (args[0] == "incp" && args.size() > 1 && args[1] != "-r") {
+        return stat(args[1].c_str(), &info) == 0 ? (int64_t) info.st_size : 0;
+    }
+    if (args[0] == "append") {
+        size_t first = line.find(' ');
+        size_t last = line.find_last_of(' ');
+        if (first == std::string::npos || last <= first) {
+            return 0;
+        }
+        std::string source = line.substr(first + 1, last - first - 1);
+        return stat(source.c_str(), &info) == 0 ? (int64_t) info.st_size : (int64_t) source.size();
+    }
+    if (args[0] == "write" && args.size() > 2) {
+        return (int64_t) line.size() - (int64_t) (args[0].size() + args[1].size() + 2);
+    }
+    if (args[0] == "pwrite" && args.size() > 3) {
+        return (int64_t) args[3].size();
+    }
+    return 0;
+}
+
+int Trace::replay(Console& console, const std::string& file, bool paced) {
+    struct Entry {
+        int64_t time;
+        int64_t bytes;
+        std::string line;
+    };
+    std::ifstream input(file);
+    if (!input.is_open()) {
+        std::cerr << "FILE NOT FOUND" << std::endl;
+        return 1;
+    }
+    std::vector<Entry> entries;
+    std::string line;
+    while (std::getline(input, line)) {
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? std::string::npos : line.find('\t', first + 1);
+        if (line.empty() || line[0] == '#' || second == std::string::npos) {
+            continue;
+        }
+        entries.push_back(Entry{std::stoll(line.substr(0, first)), std::stoll(line.substr(first + 1, second - first - 1)), line.substr(second + 1)});
+    }
+
+    // each command is timed on its own, at the recorded offsets or back to back
+    std::map<std::string, std::vector<int64_t>> latencies;
+    int64_t bytes = 0;
+    DiscardBuffer discard;
+    std::streambuf *out = std::cout.rdbuf(&discard);
+    std::streambuf *err = std::cerr.rdbuf(&discard);
+    auto start = std::chrono::steady_clock::now();
+    for (const Entry &entry : entries) {
+        std::string command = entry.line.substr(0, entry.line.find(' '));
+        if (command == "record" || command == "replay") {
+            continue;
+        }
+        if (paced) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(entry.time));
+        }
+        auto before = std::chrono::steady_clock::now();
+        try {
+            console.readLine(entry.line);
+        } catch (const std::exception &) {
+        }
+        auto after = std::chrono::steady_clock::now();
+        latencies[command].push_back(std::chrono::duration_cast<std::chrono::microseconds>(after - before).count());
+        bytes += entry.bytes;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+
+    size_t count = 0;
+    for (const auto &item : latencies) {
+        count += item.second.size();
+    }
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(3) << "COMMANDS " << count << " - TIME " << seconds << " s - "
+           << std::setprecision(1) << (seconds > 0 ? count / seconds : 0) << " COMMANDS/S - "
+           << (seconds > 0 ? bytes / seconds / (1 << 20) : 0) << " MB/S" << std::endl;
+    for (auto &item : latencies) {
+        std::vector<int64_t> &times = item.second;
+        std::sort(times.begin(), times.end());
+        int64_t sum = 0;
+        for (int64_t time : times) {
+            sum += time;
+        }
+        report << item.first << " - COUNT " << times.size() << " - AVG " << sum / (int64_t) times.size() << " us - P50 "
+               << times[times.size() / 2] << " us - P99 " << times[times.size() * 99 / 100] << " us - MAX " << times.back() << " us" << std::endl;
+    }
+    std::cout << report.str();
+    return 0;
+}
+
+int Trace::generate(const std::string& file, const std::string& mix, int64_t count) {
+    // fixed seed - the same mix and count always give the same trace
+    bool all = mix == "mixed";
+    if (!all && mix != "small" && mix != "deep" && mix != "large") {
+        std::cerr << "INVALID MIX" << std::endl;
+        return 1;
+    }
+    std::ofstream output(file, std::ios::trunc);
+    if (!output.is_open()) {
+        std::cerr << "CANNOT CREATE FILE" << std::endl;
+        return 2;
+    }
+    std::mt19937 random(1);
+    int64_t time = 0;
+    auto emit = [&output, &time](const std::string& line) {
+        output << time << '\t' << argumentSize(line) << '\t' << line << '\n';
+        time += 1000;
+    };
+    output << "# time_us\tbytes\tcommand" << std::endl;
+
+    if (all || mix == "small") {
+        // many small files, read back and half of them removed
+        int64_t files = count > 0 ? count : 1000;
+        emit("mkdir /small");
+        for (int64_t i = 0; i < files; ++i) {
+            std::string text(1 + random() % 4000, 'a');
+            for (char &c : text) {
+                c = (char) ('a' + random() % 26);
+            }
+            emit("append " + text + " /small/f" + std::to_string(i));
+        }
+        for (int64_t i = 0; i < files; ++i) {
+            emit("cat /small/f" + std::to_string(i));
+        }
+        for (int64_t i = 0; i < files; i += 2) {
+            emit("rm /small/f" + std::to_string(i));
+        }
+    }
+    if (all || mix == "deep") {
+        // one long chain of directories with a file on every level
+        int64_t depth = count > 0 ? count : 64;
+        std::string path = "/deep";
+        emit("mkdir " + path);
+        for (int64_t i = 0; i < depth; ++i) {
+            path += "/d" + std::to_string(i % 10);
+            emit("mkdir " + path);
+            emit("append level" + std::to_string(i) + " " + path + "/f");
+        }
+        emit("cd " + path);
+        emit("ls " + path);
+        emit("cat " + path + "/f");
+        emit("cd /");
+    }
+    if (all || mix == "large") {
+        // large sequential files from one host file of 16 MB, written in and read out - a mix keeps the default
+        int64_t files = count > 0 && !all ? count : 8;
+        std::string data = file + ".bin";
+        std::ofstream host(data, std::ios::binary | std::ios::trunc);
+        std::vector<uint32_t> block(1 << 16);
+        for (int i = 0; i < 64; ++i) {
+            for (uint32_t &word : block) {
+                word = random();
+            }
+            host.write(reinterpret_cast<const char *>(block.data()), block.size() * sizeof(uint32_t));
+        }
+        host.close();
+        emit("mkdir /large");
+        for (int64_t i = 0; i < files; ++i) {
+            emit("incp " + data + " /large/f" + std::to_string(i));
+        }
+        for (int64_t i = 0; i < files; ++i) {
+            emit("outcp /large/f" + std::to_string(i) + " /dev/null");
+        }
+    }
+
+    std::cout << "OK" << std::endl;
+    return 0;
+}
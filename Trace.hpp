@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+class Console;
+
+class Trace {
+public:
+    int start(const std::string& file);
+    void stop();
+    bool recording() const;
+    void record(const std::string& line);
+
+    static int replay(Console& console, const std::string& file, bool paced);
+    static int generate(const std::string& file, const std::string& mix, int64_t count);
+    static int64_t argumentSize(const std::string& line);
+
+protected:
+    std::ofstream output;
+    std::chrono::steady_clock::time_point started;
+};
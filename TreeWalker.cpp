@@ -0,0 +1,42 @@
+#include "TreeWalker.hpp"
+#include "Directory.hpp"
+
+TreeWalker::TreeWalker(std::shared_ptr<FileSystem> fileSystem) {
+    this->fileSystem = std::move(fileSystem);
+}
+
+void TreeWalker::walk(const Node& root, const Visitor& visitor) {
+    // every directory is read once, subdirectories are fanned out to the pool
+    this->pool.submit([this, root, &visitor] { this->visit(root, visitor); });
+    this->pool.wait();
+}
+
+ThreadPool& TreeWalker::getPool() {
+    return this->pool;
+}
+
+void TreeWalker::visit(const Node& directory, const Visitor& visitor) {
+    Directory content(directory.inode, this->fileSystem);
+    std::vector<int32_t> ids;
+    for (const directory_item &item : content.getItems()) {
+        ids.push_back(item.inode);
+    }
+    std::vector<std::shared_ptr<INode>> inodes = this->fileSystem->getInodes(ids);
+
+    std::vector<Node> children;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        std::string name = content.getItems()[i].item_name;
+        if (name == "." || name == ".." || inodes[i] == nullptr) {
+            continue;
+        }
+        children.push_back(Node{directory.path == "/" ? "/" + name : directory.path + "/" + name, inodes[i]});
+    }
+
+    visitor(directory, children);
+
+    for (const Node &child : children) {
+        if (child.inode->inode->isDirectory) {
+            this->pool.submit([this, child, &visitor] { this->visit(child, visitor); });
+        }
+    }
+}
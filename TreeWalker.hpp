@@ -0,0 +1,28 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FileSystem.hpp"
+#include "ThreadPool.hpp"
+
+class TreeWalker {
+public:
+    struct Node {
+        std::string path;
+        std::shared_ptr<INode> inode;
+    };
+    typedef std::function<void(const Node& directory, const std::vector<Node>& children)> Visitor;
+
+    explicit TreeWalker(std::shared_ptr<FileSystem> fileSystem);
+
+    void walk(const Node& root, const Visitor& visitor);
+    ThreadPool& getPool();
+
+protected:
+    std::shared_ptr<FileSystem> fileSystem;
+    ThreadPool pool;
+
+    void visit(const Node& directory, const Visitor& visitor);
+};
@@ -1,13 +1,30 @@
 #pragma once
 
+#include <cstddef>
 #include "structs.hpp"
 
 const int32_t ID_ITEM_FREE = 0;
+const uint32_t SUPERBLOCK_MAGIC = 0x324F4E49; // "INO2"
+const int32_t FS_VERSION = 2;
+const uint32_t ARCHIVE_MAGIC = 0x41584E49; // "INXA"
+const int32_t ARCHIVE_VERSION = 1;
 const int32_t INODE_SIZE = sizeof(pseudo_inode);
+const int32_t INODE_SIZE_V1 = sizeof(pseudo_inode_v1);
 const int32_t CLUSTER_SIZE = 2048;
-//const int32_t CLUSTER_SIZE = 512;
-//const int32_t CLUSTER_SIZE = 128;
+const int32_t MIN_CLUSTER_SIZE = 128;
+const int32_t MAX_CLUSTER_SIZE = 65536;
 const int32_t SUPERBLOCK_SIZE = sizeof(superblock);
+const int32_t SUPERBLOCK_SIZE_V1 = sizeof(superblock_v1);
 const int32_t CLUSTER_SIZE_PER_INODE_SIZE = 128;
-const int32_t LINKS_PER_CLUSTER = CLUSTER_SIZE / sizeof(int32_t);
-const int32_t MAX_FILE_SIZE = (5 + LINKS_PER_CLUSTER + LINKS_PER_CLUSTER*LINKS_PER_CLUSTER) * CLUSTER_SIZE;
+const int8_t INODE_FLAG_INLINE = 1;
+const int64_t DELAYED_WRITE_LIMIT = 8 << 20;
+const int32_t FEATURE_CHECKSUMS = 1;
+const int32_t FEATURE_DISCARD = 2;
+const size_t DISCARD_BATCH = 256;
+const size_t PREFETCH_FILES = 4;
+const int64_t PREFETCH_LIMIT = 4 << 20;
+const int32_t CHECKSUM_SIZE = sizeof(uint32_t);
+const int32_t STRIPE_UNIT = 65536;
+const int64_t STRIPE_PARALLEL_SIZE = 1 << 18;
+const int32_t INLINE_DATA_SIZE = sizeof(pseudo_inode) - offsetof(pseudo_inode, direct);
+const int32_t INLINE_DATA_SIZE_V1 = sizeof(pseudo_inode_v1) - offsetof(pseudo_inode_v1, direct);
@@ -1,9 +1,19 @@
 #include <memory>
+#include <string>
 #include "System.hpp"
 #include "Console.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
 
 int main(int argc, char *argv[]) {
+    // inode --connect <socket> talks to a daemon started by inode <image> --serve <socket>
+    if (argc > 2 && std::string(argv[1]) == "--connect") {
+        return Client(argv[2]).run();
+    }
     std::shared_ptr<System> system = std::make_shared<System>(argc > 1 ? argv[1] : "fs.dat");
+    if (argc > 3 && std::string(argv[2]) == "--serve") {
+        return Server(system, argv[3]).run();
+    }
     std::shared_ptr<Console> console = std::make_shared<Console>(system);
     console->run();
     return 0;
@@ -1,8 +1,9 @@
 #pragma once
 
 #include <iostream>
+#include <cstdint>
 
-struct superblock {
+struct superblock_v1 {
     int32_t disk_size;              //celkova velikost VFS
     int32_t inode_count;           //velikost clusteru
     int32_t cluster_count;          //pocet clusteru
@@ -13,16 +14,78 @@ struct superblock {
 };
 
 
-struct pseudo_inode {
+struct pseudo_inode_v1 {
     int32_t node_id;                //ID i-uzlu
     bool isDirectory;               //soubor, nebo adresar
     int8_t references;              //poet odkaz na i-uzel, pouv se pro hardlinky
+    int8_t flags;                   //priznaky i-uzlu (INODE_FLAG_*)
     int32_t file_size;              //velikost souboru v bytech
     int32_t direct[5];              // 1.-5. pm odkaz na datov bloky
     int32_t indirect1;              // 1. nepm odkaz (odkaz - datov bloky)
     int32_t indirect2;              // 2. nepm odkaz (odkaz - odkaz - datov bloky)
 };
 
+struct superblock {
+    uint32_t magic;                 //SUPERBLOCK_MAGIC - odlisuje v2 od v1
+    int32_t version;                //verze formatu
+    int64_t disk_size;              //celkova velikost VFS
+    int32_t inode_count;            //pocet i-uzlu
+    int32_t cluster_size;           //velikost clusteru
+    int64_t cluster_count;          //pocet clusteru
+    int32_t group_count;            //pocet alokacnich skupin
+    int32_t inodes_per_group;       //pocet i-uzlu ve skupine
+    int64_t clusters_per_group;     //pocet clusteru v plne skupine
+    int64_t group_size;             //velikost skupiny v bytech
+    int64_t group_table_address;    //adresa pocatku tabulky skupin
+    int64_t first_group_address;    //adresa pocatku prvni skupiny
+    int32_t free_inodes;            //pocet volnych i-uzlu
+    int32_t used_inodes;            //pocet pouzitych i-uzlu
+    int64_t free_clusters;          //pocet volnych clusteru
+    int64_t used_clusters;          //pocet pouzitych clusteru
+    int32_t features;               //volitelne vlastnosti (FEATURE_*)
+    int32_t group_capacity;         //kapacita tabulky skupin
+    int32_t stripe_unit;            //velikost pruhu v bytech
+    int32_t stripe_count;           //pocet souboru svazku
+};
+
+
+struct group_descriptor {
+    int64_t bitmapi_start_address;  //adresa pocatku bitmapy i-uzlu skupiny
+    int64_t bitmap_start_address;   //adresa pocatku bitmapy datovych bloku skupiny
+    int64_t inode_start_address;    //adresa pocatku i-uzlu skupiny
+    int64_t data_start_address;     //adresa pocatku datovych bloku skupiny
+    int32_t inode_count;            //pocet i-uzlu ve skupine
+    int32_t free_inodes;            //pocet volnych i-uzlu ve skupine
+    int64_t cluster_count;          //pocet clusteru ve skupine
+    int64_t free_clusters;          //pocet volnych clusteru ve skupine
+};
+
+
+struct pseudo_inode {
+    int32_t node_id;                //ID i-uzlu
+    bool isDirectory;               //soubor, nebo adresar
+    int8_t references;              //pocet odkazu na i-uzel, pouziva se pro hardlinky
+    int8_t flags;                   //priznaky i-uzlu (INODE_FLAG_*)
+    int64_t file_size;              //velikost souboru v bytech
+    int64_t direct[5];              // 1.-5. primy odkaz na datove bloky
+    int64_t indirect1;              // 1. neprimy odkaz (odkaz - datove bloky)
+    int64_t indirect2;              // 2. neprimy odkaz (odkaz - odkaz - datove bloky)
+    int64_t indirect3;              // 3. neprimy odkaz (odkaz - odkaz - odkaz - datove bloky)
+};
+
+
+struct archive_header {
+    uint32_t magic;                 //ARCHIVE_MAGIC
+    int32_t version;                //verze formatu archivu
+    int64_t image_size;             //velikost obnoveneho VFS v bytech
+};
+
+
+struct archive_extent {
+    int64_t address;                //adresa useku v obrazu, za ni nasleduji data
+    int64_t length;                 //delka useku, 0 = konec archivu
+};
+
 
 struct directory_item {
     int32_t inode;                   // inode odpovdajc souboru